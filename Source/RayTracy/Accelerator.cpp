@@ -0,0 +1,46 @@
+#include "Accelerator.h"
+#include "BVHAccelerator.h"
+#include "GridAccelerator.h"
+#include "KdTreeAccelerator.h"
+#include <string.h>
+
+bool Accelerator::ParseType(const char* name, AcceleratorType* type)
+{
+    if (strcmp(name, "bvh") == 0) {
+        *type = AcceleratorType::BVH;
+    }
+    else if (strcmp(name, "grid") == 0) {
+        *type = AcceleratorType::Grid;
+    }
+    else if (strcmp(name, "kdtree") == 0) {
+        *type = AcceleratorType::KdTree;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+const char* Accelerator::GetTypeName(AcceleratorType type)
+{
+    switch (type) {
+    case AcceleratorType::Grid:
+        return "grid";
+    case AcceleratorType::KdTree:
+        return "kdtree";
+    default:
+        return "bvh";
+    }
+}
+
+std::unique_ptr<Accelerator> Accelerator::Create(AcceleratorType type, const BVHBuildOptions& hierarchyOptions)
+{
+    switch (type) {
+    case AcceleratorType::Grid:
+        return std::unique_ptr<Accelerator>(new GridAccelerator());
+    case AcceleratorType::KdTree:
+        return std::unique_ptr<Accelerator>(new KdTreeAccelerator());
+    default:
+        return std::unique_ptr<Accelerator>(new BVHAccelerator(hierarchyOptions));
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include "Geometry.h"
+#include <memory>
+#include <vector>
+
+enum class AcceleratorType
+{
+    BVH,
+    Grid,
+    KdTree
+};
+
+/*
+    Non-owning reference to a callable invoked as intersector(primitive, maxDistance). It lets
+    the virtual accelerator interface call lambdas without wrapping them into std::function.
+*/
+class PrimitiveIntersector
+{
+private:
+    void* context;
+    bool (*function)(void* context, uint32_t primitive, float& maxDistance);
+
+    template<typename Intersector>
+    static bool Invoke(void* context, uint32_t primitive, float& maxDistance)
+    {
+        return (*(Intersector*)context)(primitive, maxDistance);
+    }
+
+public:
+    template<typename Intersector>
+    PrimitiveIntersector(Intersector& intersector) :
+        context{ &intersector },
+        function{ &Invoke<Intersector> }
+    {
+    }
+
+    inline bool operator()(uint32_t primitive, float& maxDistance) const
+    {
+        return function(context, primitive, maxDistance);
+    }
+};
+
+/*
+    Spatial index over the bounding boxes of the scene objects. Primitives with empty boxes are
+    never reported, the scene tests unbounded objects on its own.
+*/
+class Accelerator
+{
+public:
+    static bool ParseType(const char* name, AcceleratorType* type);
+    static const char* GetTypeName(AcceleratorType type);
+    static std::unique_ptr<Accelerator> Create(AcceleratorType type, const BVHBuildOptions& hierarchyOptions = BVHBuildOptions());
+
+    virtual ~Accelerator() {}
+
+    virtual void Build(const std::vector<BoundingBox>& boxes) = 0;
+
+    /*
+        Brings the structure up to date after primitive boxes changed. Returns true when it was
+        rebuilt from scratch.
+    */
+    virtual bool Update(const std::vector<BoundingBox>& boxes) = 0;
+
+    /*
+        Same contract as BVH::Intersect and BVH::IsOccluded.
+    */
+    virtual bool Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const = 0;
+    virtual bool IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const = 0;
+
+    virtual void Clear() = 0;
+};
+
+#endif
@@ -0,0 +1,637 @@
+#include "BVH.h"
+#include "BVHBuilder.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+const float QuantizationMargin = 0.01f;
+const float QuantizationRange = 253;
+const int MinExponent = -100;
+const int PrecisionBits = 12;
+const float BVH::TraversalCost = 1;
+const float BVH::IntersectionCost = 1;
+const uint32_t BVH::HotNodesSize = 4096;
+const uint32_t BVH::TreeletSize = 256;
+
+BVH::BVH() :
+    layout{ BVHLayout::Binary }
+{
+}
+
+void BVH::Build(const std::vector<BoundingBox>& boxes, const BVHBuildOptions& options, BVHBuildStatistics* statistics, const Vector3* triangles)
+{
+    BVHBuilder builder(options);
+    builder.Build(boxes, this, statistics, triangles);
+
+    layout = options.layout;
+    bounds = nodes.empty() ? BoundingBox() : nodes[0].bounds;
+
+    if (layout != BVHLayout::Binary && !nodes.empty()) {
+        if (layout == BVHLayout::Wide4) {
+            Collapse(&wideNodes4);
+        }
+        else {
+            Collapse(&wideNodes8);
+        }
+
+        nodes.clear();
+        nodes.shrink_to_fit();
+
+        if (layout == BVHLayout::Compressed8 && !Compress()) {
+            printf("BVH leaf is too large to compress, using 8-wide nodes.\n");
+            layout = BVHLayout::Wide8;
+        }
+    }
+
+    Reorder(options.nodeOrder);
+
+    if (statistics) {
+        statistics->nodesCount = GetNodesCount();
+        statistics->nodesSize = GetNodesSize();
+    }
+}
+
+template<uint32_t Width>
+void BVH::Collapse(std::vector<WideBVHNode<Width>>* wideNodes) const
+{
+    wideNodes->clear();
+    wideNodes->reserve(nodes.size() / 2 + 1);
+    wideNodes->push_back(WideBVHNode<Width>{});
+    CollapseNode(0, 0, wideNodes);
+    wideNodes->shrink_to_fit();
+}
+
+template<uint32_t Width>
+void BVH::CollapseNode(uint32_t node, uint32_t wideNode, std::vector<WideBVHNode<Width>>* wideNodes) const
+{
+    uint32_t children[Width];
+    uint32_t childrenCount = 0;
+
+    if (nodes[node].count > 0) {
+        children[childrenCount++] = node;
+    }
+    else {
+        children[childrenCount++] = nodes[node].offset;
+        children[childrenCount++] = nodes[node].offset + 1;
+    }
+
+    while (childrenCount < Width) {
+        int largest = -1;
+        float largestArea = -1;
+        for (uint32_t i = 0; i < childrenCount; i++) {
+            float area = nodes[children[i]].bounds.GetSurfaceArea();
+            if (nodes[children[i]].count == 0 && area > largestArea) {
+                largest = i;
+                largestArea = area;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        uint32_t expanded = nodes[children[largest]].offset;
+        children[largest] = expanded;
+        children[childrenCount++] = expanded + 1;
+    }
+
+    uint32_t wideChildren[Width];
+    for (uint32_t i = 0; i < childrenCount; i++) {
+        if (nodes[children[i]].count == 0) {
+            wideChildren[i] = wideNodes->size();
+            wideNodes->push_back(WideBVHNode<Width>{});
+        }
+    }
+
+    auto& result = (*wideNodes)[wideNode];
+    result.childrenCount = childrenCount;
+    for (uint32_t i = 0; i < Width; i++) {
+        const BoundingBox& childBounds = i < childrenCount ? nodes[children[i]].bounds : bounds;
+        result.minX[i] = childBounds.min.x;
+        result.minY[i] = childBounds.min.y;
+        result.minZ[i] = childBounds.min.z;
+        result.maxX[i] = childBounds.max.x;
+        result.maxY[i] = childBounds.max.y;
+        result.maxZ[i] = childBounds.max.z;
+        result.children[i] = 0;
+        result.counts[i] = 0;
+
+        if (i >= childrenCount) {
+            continue;
+        }
+
+        const BVHNode& child = nodes[children[i]];
+        if (child.count > 0) {
+            result.children[i] = child.offset;
+            result.counts[i] = child.count;
+        }
+        else {
+            result.children[i] = wideChildren[i];
+        }
+    }
+
+    for (uint32_t i = 0; i < childrenCount; i++) {
+        if (nodes[children[i]].count == 0) {
+            CollapseNode(children[i], wideChildren[i], wideNodes);
+        }
+    }
+}
+
+inline uint8_t Quantize(float value, float origin, float scale, bool upper)
+{
+    float position = (value - origin) / scale;
+    float quantized = upper ? ceilf(position) : floorf(position);
+    if (upper && quantized - position < QuantizationMargin) {
+        quantized += 1;
+    }
+    if (!upper && position - quantized < QuantizationMargin && quantized > 0) {
+        quantized -= 1;
+    }
+    return quantized < 0 ? 0 : (quantized > 255 ? 255 : quantized);
+}
+
+/*
+    Picks the power of two grid step covering the extent in 253 steps. The step is kept above a
+    small fraction of the coordinate magnitude so that flat and tiny boxes do not produce steps
+    below the float precision of the distances computed from them.
+*/
+inline int8_t GetExponent(float extent, float magnitude)
+{
+    int exponent = MinExponent;
+    if (magnitude > 0) {
+        int precisionExponent = (int)floorf(log2f(magnitude)) - PrecisionBits;
+        exponent = precisionExponent > exponent ? precisionExponent : exponent;
+    }
+    if (extent > 0) {
+        int extentExponent = (int)ceilf(log2f(extent / QuantizationRange));
+        exponent = extentExponent > exponent ? extentExponent : exponent;
+    }
+    exponent = exponent > 127 ? 127 : exponent;
+    while (exponent < 127 && extent / GetScale(exponent) > QuantizationRange) {
+        exponent++;
+    }
+    return exponent;
+}
+
+void QuantizeChildren(const BoundingBox* childBounds, CompressedBVHNode* node)
+{
+    BoundingBox nodeBounds;
+    for (uint32_t i = 0; i < node->childrenCount; i++) {
+        nodeBounds.Extend(childBounds[i]);
+    }
+    if (nodeBounds.IsEmpty()) {
+        nodeBounds = BoundingBox(Vector3{ 0, 0, 0 }, Vector3{ 0, 0, 0 });
+    }
+
+    node->origin[0] = nodeBounds.min.x;
+    node->origin[1] = nodeBounds.min.y;
+    node->origin[2] = nodeBounds.min.z;
+    node->exponents[0] = GetExponent(nodeBounds.max.x - nodeBounds.min.x, Max(fabsf(nodeBounds.min.x), fabsf(nodeBounds.max.x)));
+    node->exponents[1] = GetExponent(nodeBounds.max.y - nodeBounds.min.y, Max(fabsf(nodeBounds.min.y), fabsf(nodeBounds.max.y)));
+    node->exponents[2] = GetExponent(nodeBounds.max.z - nodeBounds.min.z, Max(fabsf(nodeBounds.min.z), fabsf(nodeBounds.max.z)));
+
+    float scaleX = GetScale(node->exponents[0]), scaleY = GetScale(node->exponents[1]), scaleZ = GetScale(node->exponents[2]);
+    for (uint32_t i = 0; i < node->childrenCount; i++) {
+        // Empty children get an inverted box that no ray can hit.
+        if (childBounds[i].IsEmpty()) {
+            node->minX[i] = node->minY[i] = node->minZ[i] = 255;
+            node->maxX[i] = node->maxY[i] = node->maxZ[i] = 0;
+            continue;
+        }
+        node->minX[i] = Quantize(childBounds[i].min.x, node->origin[0], scaleX, false);
+        node->minY[i] = Quantize(childBounds[i].min.y, node->origin[1], scaleY, false);
+        node->minZ[i] = Quantize(childBounds[i].min.z, node->origin[2], scaleZ, false);
+        node->maxX[i] = Quantize(childBounds[i].max.x, node->origin[0], scaleX, true);
+        node->maxY[i] = Quantize(childBounds[i].max.y, node->origin[1], scaleY, true);
+        node->maxZ[i] = Quantize(childBounds[i].max.z, node->origin[2], scaleZ, true);
+    }
+}
+
+bool BVH::Compress()
+{
+    for (auto& node : wideNodes8) {
+        for (uint32_t i = 0; i < node.childrenCount; i++) {
+            if (node.counts[i] > 255) {
+                wideNodes8.shrink_to_fit();
+                return false;
+            }
+        }
+    }
+
+    std::vector<uint32_t> compressedPrimitives;
+    compressedPrimitives.reserve(primitives.size());
+    compressedNodes.clear();
+    compressedNodes.reserve(wideNodes8.size());
+    compressedNodes.push_back(CompressedBVHNode{});
+    CompressNode(0, 0, &compressedPrimitives);
+
+    primitives.swap(compressedPrimitives);
+    wideNodes8.clear();
+    wideNodes8.shrink_to_fit();
+    return true;
+}
+
+void BVH::CompressNode(uint32_t wideNode, uint32_t compressedNode, std::vector<uint32_t>* compressedPrimitives)
+{
+    const auto& source = wideNodes8[wideNode];
+    BoundingBox childBounds[8];
+    for (uint32_t i = 0; i < source.childrenCount; i++) {
+        childBounds[i] = BoundingBox(Vector3{ source.minX[i], source.minY[i], source.minZ[i] }, Vector3{ source.maxX[i], source.maxY[i], source.maxZ[i] });
+    }
+
+    CompressedBVHNode result = {};
+    result.childrenCount = source.childrenCount;
+    result.childBase = compressedNodes.size();
+    result.primitiveBase = compressedPrimitives->size();
+    QuantizeChildren(childBounds, &result);
+
+    uint32_t innerCount = 0;
+    for (uint32_t i = 0; i < source.childrenCount; i++) {
+        result.counts[i] = source.counts[i];
+
+        if (source.counts[i] > 0) {
+            for (uint32_t j = 0; j < source.counts[i]; j++) {
+                compressedPrimitives->push_back(primitives[source.children[i] + j]);
+            }
+        }
+        else {
+            innerCount++;
+        }
+    }
+
+    compressedNodes.resize(compressedNodes.size() + innerCount);
+    compressedNodes[compressedNode] = result;
+
+    uint32_t child = result.childBase;
+    for (uint32_t i = 0; i < source.childrenCount; i++) {
+        if (source.counts[i] == 0) {
+            CompressNode(source.children[i], child++, compressedPrimitives);
+        }
+    }
+}
+
+float BVH::Refit(const std::vector<BoundingBox>& boxes)
+{
+    float cost;
+    switch (layout) {
+    case BVHLayout::Wide4:
+        cost = RefitWide(&wideNodes4, boxes);
+        break;
+    case BVHLayout::Wide8:
+        cost = RefitWide(&wideNodes8, boxes);
+        break;
+    case BVHLayout::Compressed8:
+        cost = RefitWide(&compressedNodes, boxes);
+        break;
+    default:
+        cost = RefitBinary(boxes);
+        break;
+    }
+
+    float rootArea = bounds.GetSurfaceArea();
+    return rootArea > 0 ? cost / rootArea : 0;
+}
+
+float BVH::RefitBinary(const std::vector<BoundingBox>& boxes)
+{
+    float cost = 0;
+
+    // Children are always stored after their parent, so a reverse pass sees them first.
+    for (uint32_t i = nodes.size(); i-- > 0;) {
+        auto& node = nodes[i];
+        node.bounds = BoundingBox();
+        if (node.count > 0) {
+            for (uint32_t j = 0; j < node.count; j++) {
+                node.bounds.Extend(boxes[primitives[node.offset + j]]);
+            }
+            cost += node.bounds.GetSurfaceArea() * node.count * IntersectionCost;
+        }
+        else {
+            node.bounds.Extend(nodes[node.offset].bounds);
+            node.bounds.Extend(nodes[node.offset + 1].bounds);
+            cost += node.bounds.GetSurfaceArea() * TraversalCost;
+        }
+    }
+
+    bounds = nodes.empty() ? BoundingBox() : nodes[0].bounds;
+    return cost;
+}
+
+template<uint32_t Width>
+void SetChildrenBounds(WideBVHNode<Width>* node, const BoundingBox* childBounds)
+{
+    for (uint32_t i = 0; i < node->childrenCount; i++) {
+        node->minX[i] = childBounds[i].min.x;
+        node->minY[i] = childBounds[i].min.y;
+        node->minZ[i] = childBounds[i].min.z;
+        node->maxX[i] = childBounds[i].max.x;
+        node->maxY[i] = childBounds[i].max.y;
+        node->maxZ[i] = childBounds[i].max.z;
+    }
+}
+
+void SetChildrenBounds(CompressedBVHNode* node, const BoundingBox* childBounds)
+{
+    QuantizeChildren(childBounds, node);
+}
+
+template<typename Node>
+float BVH::RefitWide(std::vector<Node>* wideNodes, const std::vector<BoundingBox>& boxes)
+{
+    const uint32_t Width = Node::Arity;
+    std::vector<BoundingBox> nodeBounds(wideNodes->size());
+    float cost = 0;
+
+    for (uint32_t i = wideNodes->size(); i-- > 0;) {
+        auto& node = (*wideNodes)[i];
+        uint32_t children[Width], counts[Width];
+        BoundingBox childBounds[Width];
+        GetChildren(node, children, counts);
+
+        for (uint32_t j = 0; j < node.childrenCount; j++) {
+            if (counts[j] > 0) {
+                for (uint32_t k = 0; k < counts[j]; k++) {
+                    childBounds[j].Extend(boxes[primitives[children[j] + k]]);
+                }
+                cost += childBounds[j].GetSurfaceArea() * counts[j] * IntersectionCost;
+            }
+            else {
+                childBounds[j] = nodeBounds[children[j]];
+            }
+            nodeBounds[i].Extend(childBounds[j]);
+        }
+
+        SetChildrenBounds(&node, childBounds);
+        cost += nodeBounds[i].GetSurfaceArea() * TraversalCost;
+    }
+
+    bounds = nodeBounds.empty() ? BoundingBox() : nodeBounds[0];
+    return cost;
+}
+
+inline uint32_t GetChildGroup(const BVHNode& node, uint32_t* first)
+{
+    *first = node.offset;
+    return node.count > 0 ? 0 : 2;
+}
+
+template<uint32_t Width>
+uint32_t GetChildGroup(const WideBVHNode<Width>& node, uint32_t* first)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < node.childrenCount; i++) {
+        if (node.counts[i] == 0 && count++ == 0) {
+            *first = node.children[i];
+        }
+    }
+    return count;
+}
+
+inline uint32_t GetChildGroup(const CompressedBVHNode& node, uint32_t* first)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < node.childrenCount; i++) {
+        count += node.counts[i] == 0 ? 1 : 0;
+    }
+    *first = node.childBase;
+    return count;
+}
+
+inline void MoveChildGroup(BVHNode* node, uint32_t first)
+{
+    node->offset = first;
+}
+
+template<uint32_t Width>
+void MoveChildGroup(WideBVHNode<Width>* node, uint32_t first)
+{
+    for (uint32_t i = 0; i < node->childrenCount; i++) {
+        if (node->counts[i] == 0) {
+            node->children[i] = first++;
+        }
+    }
+}
+
+inline void MoveChildGroup(CompressedBVHNode* node, uint32_t first)
+{
+    node->childBase = first;
+}
+
+inline float GetNodeArea(const BVHNode& node)
+{
+    return node.bounds.GetSurfaceArea();
+}
+
+template<uint32_t Width>
+float GetNodeArea(const WideBVHNode<Width>& node)
+{
+    BoundingBox bounds;
+    for (uint32_t i = 0; i < node.childrenCount; i++) {
+        bounds.Extend(BoundingBox(Vector3{ node.minX[i], node.minY[i], node.minZ[i] }, Vector3{ node.maxX[i], node.maxY[i], node.maxZ[i] }));
+    }
+    return bounds.GetSurfaceArea();
+}
+
+inline float GetNodeArea(const CompressedBVHNode& node)
+{
+    const uint8_t* mins[3] = { node.minX, node.minY, node.minZ };
+    const uint8_t* maxs[3] = { node.maxX, node.maxY, node.maxZ };
+    float extents[3];
+    for (int axis = 0; axis < 3; axis++) {
+        uint32_t min = 255, max = 0;
+        for (uint32_t i = 0; i < node.childrenCount; i++) {
+            min = std::min<uint32_t>(min, mins[axis][i]);
+            max = std::max<uint32_t>(max, maxs[axis][i]);
+        }
+        extents[axis] = max > min ? (max - min) * GetScale(node.exponents[axis]) : 0;
+    }
+    return 2 * (extents[0] * extents[1] + extents[1] * extents[2] + extents[2] * extents[0]);
+}
+
+template<typename Node>
+void BVH::ReorderNodes(std::vector<Node>* reorderedNodes, BVHNodeOrder order) const
+{
+    // Inner children of a node are a contiguous group, groups are moved as a whole.
+    struct Group
+    {
+        uint32_t first;
+        uint32_t count;
+        float area;
+    };
+
+    const auto& source = *reorderedNodes;
+    std::vector<Node> result;
+    std::vector<uint32_t> positions(source.size());
+    result.reserve(source.size());
+
+    auto emit = [&](const Group& group) {
+        for (uint32_t i = 0; i < group.count; i++) {
+            positions[group.first + i] = result.size();
+            result.push_back(source[group.first + i]);
+        }
+    };
+    auto addChildren = [&](const Group& group, std::vector<Group>* groups) {
+        for (uint32_t i = 0; i < group.count; i++) {
+            Group child;
+            child.count = GetChildGroup(source[group.first + i], &child.first);
+            if (child.count > 0) {
+                child.area = GetNodeArea(source[group.first + i]);
+                groups->push_back(child);
+            }
+        }
+    };
+
+    std::vector<Group> queue{ Group{ 0, 1, 0 } };
+    size_t head = 0;
+    while (head < queue.size() && result.size() * sizeof(Node) < HotNodesSize) {
+        auto group = queue[head++];
+        emit(group);
+        addChildren(group, &queue);
+    }
+
+    std::vector<Group> stack(queue.rbegin(), queue.rend() - head), candidates;
+    while (!stack.empty()) {
+        auto group = stack.back();
+        stack.pop_back();
+        emit(group);
+        candidates.clear();
+        addChildren(group, &candidates);
+
+        if (order == BVHNodeOrder::Treelet) {
+            uint32_t size = group.count * sizeof(Node);
+            while (!candidates.empty()) {
+                auto largest = std::max_element(candidates.begin(), candidates.end(), [](const Group& a, const Group& b) {
+                    return a.area < b.area;
+                });
+                if (size + largest->count * sizeof(Node) > TreeletSize) {
+                    break;
+                }
+                auto next = *largest;
+                candidates.erase(largest);
+                size += next.count * sizeof(Node);
+                emit(next);
+                addChildren(next, &candidates);
+            }
+        }
+
+        stack.insert(stack.end(), candidates.rbegin(), candidates.rend());
+    }
+
+    for (auto& node : result) {
+        uint32_t first;
+        if (GetChildGroup(node, &first) > 0) {
+            MoveChildGroup(&node, positions[first]);
+        }
+    }
+    reorderedNodes->swap(result);
+}
+
+void BVH::Reorder(BVHNodeOrder order)
+{
+    if (order == BVHNodeOrder::Build || GetNodesCount() == 0) {
+        return;
+    }
+
+    switch (layout) {
+    case BVHLayout::Wide4:
+        ReorderNodes(&wideNodes4, order);
+        break;
+    case BVHLayout::Wide8:
+        ReorderNodes(&wideNodes8, order);
+        break;
+    case BVHLayout::Compressed8:
+        ReorderNodes(&compressedNodes, order);
+        break;
+    default:
+        ReorderNodes(&nodes, order);
+        break;
+    }
+}
+
+bool BVH::ParseNodeOrder(const char* name, BVHNodeOrder* order)
+{
+    if (strcmp(name, "build") == 0) {
+        *order = BVHNodeOrder::Build;
+    }
+    else if (strcmp(name, "dfs") == 0) {
+        *order = BVHNodeOrder::DepthFirst;
+    }
+    else if (strcmp(name, "treelet") == 0) {
+        *order = BVHNodeOrder::Treelet;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+const char* BVH::GetNodeOrderName(BVHNodeOrder order)
+{
+    switch (order) {
+    case BVHNodeOrder::DepthFirst:
+        return "dfs";
+    case BVHNodeOrder::Treelet:
+        return "treelet";
+    default:
+        return "build";
+    }
+}
+
+void BVH::RenumberPrimitives(std::vector<uint32_t>* order)
+{
+    *order = primitives;
+    for (uint32_t i = 0; i < primitives.size(); i++) {
+        primitives[i] = i;
+    }
+}
+
+void BVH::Clear()
+{
+    bounds = BoundingBox();
+    nodes.clear();
+    wideNodes4.clear();
+    wideNodes8.clear();
+    compressedNodes.clear();
+    primitives.clear();
+}
+
+bool BVH::IsEmpty() const
+{
+    return primitives.empty();
+}
+
+BoundingBox BVH::GetBounds() const
+{
+    return bounds;
+}
+
+uint32_t BVH::GetNodesCount() const
+{
+    switch (layout) {
+    case BVHLayout::Wide4:
+        return wideNodes4.size();
+    case BVHLayout::Wide8:
+        return wideNodes8.size();
+    case BVHLayout::Compressed8:
+        return compressedNodes.size();
+    default:
+        return nodes.size();
+    }
+}
+
+uint32_t BVH::GetNodesSize() const
+{
+    switch (layout) {
+    case BVHLayout::Wide4:
+        return wideNodes4.size() * sizeof(WideBVHNode<4>);
+    case BVHLayout::Wide8:
+        return wideNodes8.size() * sizeof(WideBVHNode<8>);
+    case BVHLayout::Compressed8:
+        return compressedNodes.size() * sizeof(CompressedBVHNode);
+    default:
+        return nodes.size() * sizeof(BVHNode);
+    }
+}
+
+BVHLayout BVH::GetLayout() const
+{
+    return layout;
+}
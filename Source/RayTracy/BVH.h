@@ -0,0 +1,420 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "BoundingBox.h"
+#include "WideBVH.h"
+#include <stdint.h>
+#include <vector>
+
+struct BVHNode
+{
+    BoundingBox bounds;
+    uint32_t offset;
+    uint32_t count;
+};
+
+enum class BVHLayout
+{
+    Binary,
+    Wide4,
+    Wide8,
+    Compressed8
+};
+
+/*
+    Memory order of the nodes after the build. DepthFirst and Treelet both store the top levels
+    breadth first, then the subtrees below them depth first or as treelets grown towards the
+    children with the largest surface area. Siblings always stay together after their parent.
+*/
+enum class BVHNodeOrder
+{
+    Build,
+    DepthFirst,
+    Treelet
+};
+
+struct BVHBuildOptions
+{
+    uint32_t binsCount;
+    uint32_t maxLeafSize;
+    uint32_t threadsCount;
+    BVHLayout layout;
+    BVHNodeOrder nodeOrder;
+
+    /*
+        Spatial splits (SBVH) clip triangles at bin planes, so a triangle can be referenced by
+        several leaves. maxDuplication caps the extra references relative to the primitives count.
+        Only builds given triangle vertices can split spatially.
+    */
+    bool spatialSplits;
+    float maxDuplication;
+
+    BVHBuildOptions() :
+        binsCount{ 16 },
+        maxLeafSize{ 4 },
+        threadsCount{ 0 },
+        layout{ BVHLayout::Binary },
+        nodeOrder{ BVHNodeOrder::Build },
+        spatialSplits{ false },
+        maxDuplication{ 0.25f }
+    {
+    }
+};
+
+struct BVHBuildStatistics
+{
+    double buildTime;
+    float sahCost;
+    uint32_t nodesCount;
+    uint32_t nodesSize;
+    uint32_t referencesCount;
+};
+
+class BVH
+{
+private:
+    friend class BVHBuilder;
+    friend class BVHCache;
+
+    static const uint32_t MaxDepth = 64;
+    static const float TraversalCost;
+    static const float IntersectionCost;
+    static const uint32_t HotNodesSize;
+    static const uint32_t TreeletSize;
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float distance;
+    };
+
+    BVHLayout layout;
+    BoundingBox bounds;
+    std::vector<BVHNode> nodes;
+    std::vector<WideBVHNode<4>> wideNodes4;
+    std::vector<WideBVHNode<8>> wideNodes8;
+    std::vector<CompressedBVHNode> compressedNodes;
+    std::vector<uint32_t> primitives;
+
+    template<uint32_t Width>
+    void Collapse(std::vector<WideBVHNode<Width>>* wideNodes) const;
+
+    template<uint32_t Width>
+    void CollapseNode(uint32_t node, uint32_t wideNode, std::vector<WideBVHNode<Width>>* wideNodes) const;
+
+    float RefitBinary(const std::vector<BoundingBox>& boxes);
+
+    template<typename Node>
+    float RefitWide(std::vector<Node>* wideNodes, const std::vector<BoundingBox>& boxes);
+
+    template<typename Node>
+    void ReorderNodes(std::vector<Node>* reorderedNodes, BVHNodeOrder order) const;
+
+    bool Compress();
+    void CompressNode(uint32_t wideNode, uint32_t compressedNode, std::vector<uint32_t>* compressedPrimitives);
+
+    template<typename Intersector>
+    bool IntersectBinary(const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const;
+
+    template<typename Intersector>
+    bool IsOccludedBinary(const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const;
+
+    template<typename Node, typename Intersector>
+    bool IntersectWide(const std::vector<Node>& wideNodes, const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const;
+
+    template<typename Node, typename Intersector>
+    bool IsOccludedWide(const std::vector<Node>& wideNodes, const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const;
+
+public:
+    BVH();
+
+    /*
+        triangles optionally holds three vertices per box and enables spatial splits when they
+        are requested by the options. Leaves may then reference the same primitive more than once.
+    */
+    void Build(const std::vector<BoundingBox>& boxes, const BVHBuildOptions& options = BVHBuildOptions(), BVHBuildStatistics* statistics = nullptr,
+        const Vector3* triangles = nullptr);
+    void Clear();
+
+    /*
+        Recomputes the node bounds for new primitive boxes while keeping the tree topology.
+        Returns the SAH cost of the refitted tree relative to its root area, callers compare it
+        with the cost right after a build to decide when to rebuild instead.
+    */
+    float Refit(const std::vector<BoundingBox>& boxes);
+
+    /*
+        Renumbers primitives in the order the leaves reference them, so that every leaf covers a
+        contiguous range of primitive indices. order receives the previous index of each primitive.
+    */
+    void RenumberPrimitives(std::vector<uint32_t>* order);
+
+    /*
+        Rearranges the nodes of any layout in memory without changing the tree. Build keeps the
+        current order.
+    */
+    void Reorder(BVHNodeOrder order);
+
+    static bool ParseNodeOrder(const char* name, BVHNodeOrder* order);
+    static const char* GetNodeOrderName(BVHNodeOrder order);
+
+    bool IsEmpty() const;
+    BoundingBox GetBounds() const;
+    uint32_t GetNodesCount() const;
+    uint32_t GetNodesSize() const;
+    BVHLayout GetLayout() const;
+
+    /*
+        Finds the closest primitive hit. The intersector is called as intersector(primitive, maxDistance),
+        must return true on a hit closer than maxDistance and lower maxDistance to the hit distance.
+    */
+    template<typename Intersector>
+    bool Intersect(const Vector3& origin, const Vector3& direction, float maxDistance, Intersector intersector) const
+    {
+        switch (layout) {
+        case BVHLayout::Wide4:
+            return IntersectWide(wideNodes4, origin, direction, maxDistance, intersector);
+        case BVHLayout::Wide8:
+            return IntersectWide(wideNodes8, origin, direction, maxDistance, intersector);
+        case BVHLayout::Compressed8:
+            return IntersectWide(compressedNodes, origin, direction, maxDistance, intersector);
+        default:
+            return IntersectBinary(origin, direction, maxDistance, intersector);
+        }
+    }
+
+    /*
+        Returns as soon as the intersector reports any hit closer than maxDistance.
+        The intersector is called as intersector(primitive, maxDistance).
+    */
+    template<typename Intersector>
+    bool IsOccluded(const Vector3& origin, const Vector3& direction, float maxDistance, Intersector intersector) const
+    {
+        switch (layout) {
+        case BVHLayout::Wide4:
+            return IsOccludedWide(wideNodes4, origin, direction, maxDistance, intersector);
+        case BVHLayout::Wide8:
+            return IsOccludedWide(wideNodes8, origin, direction, maxDistance, intersector);
+        case BVHLayout::Compressed8:
+            return IsOccludedWide(compressedNodes, origin, direction, maxDistance, intersector);
+        default:
+            return IsOccludedBinary(origin, direction, maxDistance, intersector);
+        }
+    }
+};
+
+template<typename Intersector>
+bool BVH::IntersectBinary(const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+
+    Vector3 inverseDirection{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    StackEntry stack[MaxDepth];
+    uint32_t stackSize = 0;
+    bool hasIntersection = false;
+    float distance;
+
+    if (!nodes[0].bounds.HasIntersection(origin, inverseDirection, maxDistance, &distance)) {
+        return false;
+    }
+    stack[stackSize++] = StackEntry{ 0, distance };
+
+    while (stackSize > 0) {
+        auto entry = stack[--stackSize];
+        if (entry.distance > maxDistance) {
+            continue;
+        }
+
+        uint32_t nodeIndex = entry.node;
+        while (true) {
+            const BVHNode& node = nodes[nodeIndex];
+            if (node.count > 0) {
+                for (uint32_t i = 0; i < node.count; i++) {
+                    if (intersector(primitives[node.offset + i], maxDistance)) {
+                        hasIntersection = true;
+                    }
+                }
+                break;
+            }
+
+            uint32_t left = node.offset, right = node.offset + 1;
+            float leftDistance, rightDistance;
+            bool hitLeft = nodes[left].bounds.HasIntersection(origin, inverseDirection, maxDistance, &leftDistance);
+            bool hitRight = nodes[right].bounds.HasIntersection(origin, inverseDirection, maxDistance, &rightDistance);
+
+            if (hitLeft && hitRight) {
+                if (rightDistance < leftDistance) {
+                    stack[stackSize++] = StackEntry{ left, leftDistance };
+                    nodeIndex = right;
+                }
+                else {
+                    stack[stackSize++] = StackEntry{ right, rightDistance };
+                    nodeIndex = left;
+                }
+            }
+            else if (hitLeft) {
+                nodeIndex = left;
+            }
+            else if (hitRight) {
+                nodeIndex = right;
+            }
+            else {
+                break;
+            }
+        }
+    }
+
+    return hasIntersection;
+}
+
+template<typename Intersector>
+bool BVH::IsOccludedBinary(const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+
+    Vector3 inverseDirection{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    uint32_t stack[MaxDepth];
+    uint32_t stackSize = 0;
+    float distance;
+
+    if (!nodes[0].bounds.HasIntersection(origin, inverseDirection, maxDistance, &distance)) {
+        return false;
+    }
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const BVHNode& node = nodes[stack[--stackSize]];
+        if (node.count > 0) {
+            for (uint32_t i = 0; i < node.count; i++) {
+                if (intersector(primitives[node.offset + i], maxDistance)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        for (uint32_t child = node.offset; child < node.offset + 2; child++) {
+            if (nodes[child].bounds.HasIntersection(origin, inverseDirection, maxDistance, &distance)) {
+                stack[stackSize++] = child;
+            }
+        }
+    }
+
+    return false;
+}
+
+template<typename Node, typename Intersector>
+bool BVH::IntersectWide(const std::vector<Node>& wideNodes, const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const
+{
+    if (wideNodes.empty()) {
+        return false;
+    }
+
+    const uint32_t Width = Node::Arity;
+    Vector3 inverseDirection{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    StackEntry stack[MaxDepth * Width];
+    uint32_t stackSize = 0;
+    bool hasIntersection = false;
+
+    stack[stackSize++] = StackEntry{ 0, 0 };
+
+    while (stackSize > 0) {
+        auto entry = stack[--stackSize];
+        if (entry.distance > maxDistance) {
+            continue;
+        }
+
+        const auto& node = wideNodes[entry.node];
+        float distances[Width];
+        uint32_t mask = IntersectChildren(node, origin, inverseDirection, maxDistance, distances);
+        if (mask == 0) {
+            continue;
+        }
+
+        uint32_t nodeChildren[Width], counts[Width];
+        GetChildren(node, nodeChildren, counts);
+
+        StackEntry children[Width];
+        uint32_t childrenCount = 0;
+
+        for (uint32_t i = 0; i < Width; i++) {
+            if (!(mask & (1u << i)) || distances[i] > maxDistance) {
+                continue;
+            }
+
+            if (counts[i] > 0) {
+                for (uint32_t j = 0; j < counts[i]; j++) {
+                    if (intersector(primitives[nodeChildren[i] + j], maxDistance)) {
+                        hasIntersection = true;
+                    }
+                }
+                continue;
+            }
+
+            uint32_t position = childrenCount++;
+            while (position > 0 && children[position - 1].distance < distances[i]) {
+                children[position] = children[position - 1];
+                position--;
+            }
+            children[position] = StackEntry{ nodeChildren[i], distances[i] };
+        }
+
+        for (uint32_t i = 0; i < childrenCount; i++) {
+            stack[stackSize++] = children[i];
+        }
+    }
+
+    return hasIntersection;
+}
+
+template<typename Node, typename Intersector>
+bool BVH::IsOccludedWide(const std::vector<Node>& wideNodes, const Vector3& origin, const Vector3& direction, float maxDistance, Intersector& intersector) const
+{
+    if (wideNodes.empty()) {
+        return false;
+    }
+
+    const uint32_t Width = Node::Arity;
+    Vector3 inverseDirection{ 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+    uint32_t stack[MaxDepth * Width];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const auto& node = wideNodes[stack[--stackSize]];
+        float distances[Width];
+        uint32_t mask = IntersectChildren(node, origin, inverseDirection, maxDistance, distances);
+        if (mask == 0) {
+            continue;
+        }
+
+        uint32_t nodeChildren[Width], counts[Width];
+        GetChildren(node, nodeChildren, counts);
+
+        for (uint32_t i = 0; i < Width; i++) {
+            if (!(mask & (1u << i))) {
+                continue;
+            }
+
+            if (counts[i] == 0) {
+                stack[stackSize++] = nodeChildren[i];
+                continue;
+            }
+
+            for (uint32_t j = 0; j < counts[i]; j++) {
+                if (intersector(primitives[nodeChildren[i] + j], maxDistance)) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+#endif
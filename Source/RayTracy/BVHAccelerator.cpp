@@ -0,0 +1,46 @@
+#include "BVHAccelerator.h"
+
+const float BVHAccelerator::RebuildCostRatio = 1.5f;
+
+BVHAccelerator::BVHAccelerator(const BVHBuildOptions& options) :
+    options{ options },
+    buildCost{ 0 }
+{
+}
+
+void BVHAccelerator::Build(const std::vector<BoundingBox>& boxes)
+{
+    hierarchy.Build(boxes, options);
+    // Refitting an unchanged tree only measures it, this is the reference for later refits.
+    buildCost = hierarchy.Refit(boxes);
+}
+
+bool BVHAccelerator::Update(const std::vector<BoundingBox>& boxes)
+{
+    if (hierarchy.Refit(boxes) <= buildCost * RebuildCostRatio) {
+        return false;
+    }
+    Build(boxes);
+    return true;
+}
+
+bool BVHAccelerator::Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const
+{
+    return hierarchy.Intersect(ray.origin, ray.direction, maxDistance, intersector);
+}
+
+bool BVHAccelerator::IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const
+{
+    return hierarchy.IsOccluded(ray.origin, ray.direction, maxDistance, intersector);
+}
+
+void BVHAccelerator::Reorder(BVHNodeOrder order)
+{
+    options.nodeOrder = order;
+    hierarchy.Reorder(order);
+}
+
+void BVHAccelerator::Clear()
+{
+    hierarchy.Clear();
+}
@@ -0,0 +1,34 @@
+#ifndef BVH_ACCELERATOR_H
+#define BVH_ACCELERATOR_H
+
+#include "Accelerator.h"
+
+/*
+    Scene level BVH. Moved objects are handled by refitting, the tree is rebuilt only when the
+    refitted SAH cost grows by more than RebuildCostRatio since the last build.
+*/
+class BVHAccelerator : public Accelerator
+{
+private:
+    static const float RebuildCostRatio;
+
+    BVH hierarchy;
+    BVHBuildOptions options;
+    float buildCost;
+
+public:
+    BVHAccelerator(const BVHBuildOptions& options);
+
+    virtual void Build(const std::vector<BoundingBox>& boxes) override;
+    virtual bool Update(const std::vector<BoundingBox>& boxes) override;
+    virtual bool Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const override;
+    virtual bool IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const override;
+    virtual void Clear() override;
+
+    /*
+        Changes the node order of the current tree and of later rebuilds.
+    */
+    void Reorder(BVHNodeOrder order);
+};
+
+#endif
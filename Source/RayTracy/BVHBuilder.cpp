@@ -0,0 +1,533 @@
+#include "BVHBuilder.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+const uint32_t BVHBuilder::MinBinsCount = 4;
+const uint32_t BVHBuilder::MaxBinsCount = 64;
+const uint32_t BVHBuilder::ParallelThreshold = 4096;
+const float BVHBuilder::TraversalCost = 1.0f;
+const float BVHBuilder::IntersectionCost = 1.0f;
+const float BVHBuilder::SpatialSplitOverlap = 1e-5f;
+
+BVHBuilder::BVHBuilder(const BVHBuildOptions& options) :
+    options(options),
+    triangles(nullptr),
+    rootArea(0),
+    bvh(nullptr),
+    nodesCount{ 0 },
+    primitivesCount{ 0 },
+    pendingTasks{ 0 }
+{
+    this->options.binsCount = std::max(2u, std::min(this->options.binsCount, MaxBinsCount));
+    this->options.maxLeafSize = std::max(1u, this->options.maxLeafSize);
+    if (this->options.threadsCount == 0) {
+        this->options.threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+void BVHBuilder::Build(const std::vector<BoundingBox>& boxes, BVH* bvh, BVHBuildStatistics* statistics, const Vector3* triangles)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    this->bvh = bvh;
+    this->triangles = options.spatialSplits ? triangles : nullptr;
+    bvh->Clear();
+
+    references = std::make_shared<References>();
+    references->reserve(boxes.size());
+    Task root{ 0, 0, 0, 0, BoundingBox(), BoundingBox(), references, 0 };
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        if (!boxes[i].IsEmpty()) {
+            Reference reference{ boxes[i], boxes[i].GetCenter(), i };
+            root.bounds.Extend(reference.bounds);
+            root.centerBounds.Extend(reference.center);
+            references->push_back(reference);
+        }
+    }
+
+    uint32_t referencesCount = references->size();
+    if (referencesCount > 0) {
+        uint32_t maxReferencesCount = referencesCount;
+        if (this->triangles) {
+            root.budget = (uint32_t)(referencesCount * Max(options.maxDuplication, 0.0f));
+            maxReferencesCount += root.budget;
+        }
+
+        rootArea = root.bounds.GetSurfaceArea();
+        bvh->nodes.resize(2 * maxReferencesCount - 1);
+        bvh->primitives.resize(maxReferencesCount);
+        nodesCount = 1;
+        primitivesCount = 0;
+        pendingTasks = 1;
+        root.end = referencesCount;
+        tasks.push_back(std::move(root));
+        if (this->triangles) {
+            references.reset();
+        }
+
+        std::vector<std::thread> threads;
+        if (referencesCount > ParallelThreshold) {
+            for (uint32_t i = 1; i < options.threadsCount; i++) {
+                threads.push_back(std::thread(&BVHBuilder::Worker, this));
+            }
+        }
+        Worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        bvh->nodes.resize(nodesCount);
+        bvh->nodes.shrink_to_fit();
+
+        if (this->triangles) {
+            bvh->primitives.resize(primitivesCount);
+            bvh->primitives.shrink_to_fit();
+        }
+        else {
+            for (uint32_t i = 0; i < referencesCount; i++) {
+                bvh->primitives[i] = (*references)[i].primitive;
+            }
+        }
+    }
+
+    references.reset();
+
+    if (statistics) {
+        statistics->buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        statistics->sahCost = CalculateCost();
+        statistics->nodesCount = bvh->nodes.size();
+        statistics->nodesSize = bvh->nodes.size() * sizeof(BVHNode);
+        statistics->referencesCount = bvh->primitives.size();
+    }
+}
+
+void BVHBuilder::Worker()
+{
+    Scratch scratch;
+    scratch.bins.resize(3 * options.binsCount);
+    scratch.spatialBins.resize(triangles ? 3 * options.binsCount : 0);
+    scratch.rightBounds.resize(options.binsCount);
+    scratch.rightCenterBounds.resize(options.binsCount);
+    scratch.rightCounts.resize(options.binsCount);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [this] { return !tasks.empty() || pendingTasks == 0; });
+        if (tasks.empty()) {
+            return;
+        }
+
+        auto task = std::move(tasks.back());
+        tasks.pop_back();
+
+        lock.unlock();
+        BuildNode(task, scratch);
+        lock.lock();
+
+        if (--pendingTasks == 0) {
+            condition.notify_all();
+        }
+    }
+}
+
+void BVHBuilder::PushTask(Task&& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        pendingTasks++;
+    }
+    condition.notify_one();
+}
+
+uint32_t BVHBuilder::GetBin(float center, float min, float scale, uint32_t binsCount) const
+{
+    uint32_t bin = (center - min) * scale;
+    return std::min(bin, binsCount - 1);
+}
+
+bool BVHBuilder::FindSplit(const Task& task, Scratch& scratch, Split* split) const
+{
+    uint32_t binsCount = std::min(options.binsCount, std::max(MinBinsCount, task.end - task.begin));
+    Bin* bins[3] = { &scratch.bins[0], &scratch.bins[binsCount], &scratch.bins[2 * binsCount] };
+    auto references = task.references->data();
+    float min[3], scale[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = GetAxis(task.centerBounds.min, axis);
+        float extent = GetAxis(task.centerBounds.max, axis) - min[axis];
+        scale[axis] = extent > 0 ? binsCount / extent : 0;
+        for (uint32_t i = 0; i < binsCount; i++) {
+            bins[axis][i] = Bin{ BoundingBox(), BoundingBox(), 0 };
+        }
+    }
+
+    for (uint32_t i = task.begin; i < task.end; i++) {
+        auto& reference = references[i];
+        for (int axis = 0; axis < 3; axis++) {
+            auto& bin = bins[axis][GetBin(GetAxis(reference.center, axis), min[axis], scale[axis], binsCount)];
+            bin.bounds.Extend(reference.bounds);
+            bin.centerBounds.Extend(reference.center);
+            bin.count++;
+        }
+    }
+
+    bool found = false;
+    split->cost = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0) {
+            continue;
+        }
+
+        BoundingBox bounds, centerBounds;
+        uint32_t count = 0;
+        for (uint32_t i = binsCount - 1; i > 0; i--) {
+            bounds.Extend(bins[axis][i].bounds);
+            centerBounds.Extend(bins[axis][i].centerBounds);
+            count += bins[axis][i].count;
+            scratch.rightBounds[i] = bounds;
+            scratch.rightCenterBounds[i] = centerBounds;
+            scratch.rightCounts[i] = count;
+        }
+
+        bounds = BoundingBox();
+        centerBounds = BoundingBox();
+        count = 0;
+        for (uint32_t i = 0; i < binsCount - 1; i++) {
+            bounds.Extend(bins[axis][i].bounds);
+            centerBounds.Extend(bins[axis][i].centerBounds);
+            count += bins[axis][i].count;
+            uint32_t rightCount = scratch.rightCounts[i + 1];
+            if (count == 0 || rightCount == 0) {
+                continue;
+            }
+            float cost = bounds.GetSurfaceArea() * count + scratch.rightBounds[i + 1].GetSurfaceArea() * rightCount;
+            if (cost < split->cost) {
+                split->axis = axis;
+                split->bin = i;
+                split->binsCount = binsCount;
+                split->cost = cost;
+                split->leftBounds = bounds;
+                split->leftCenterBounds = centerBounds;
+                split->rightBounds = scratch.rightBounds[i + 1];
+                split->rightCenterBounds = scratch.rightCenterBounds[i + 1];
+                found = true;
+            }
+        }
+    }
+
+    if (found) {
+        split->cost = TraversalCost + IntersectionCost * split->cost / task.bounds.GetSurfaceArea();
+    }
+
+    return found;
+}
+
+bool BVHBuilder::FindSpatialSplit(const Task& task, Scratch& scratch, SpatialSplit* split) const
+{
+    uint32_t binsCount = std::min(options.binsCount, std::max(MinBinsCount, task.end - task.begin));
+    SpatialBin* bins[3] = { &scratch.spatialBins[0], &scratch.spatialBins[binsCount], &scratch.spatialBins[2 * binsCount] };
+    auto references = task.references->data();
+    float min[3], scale[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = GetAxis(task.bounds.min, axis);
+        float extent = GetAxis(task.bounds.max, axis) - min[axis];
+        scale[axis] = extent > 0 ? binsCount / extent : 0;
+        for (uint32_t i = 0; i < binsCount; i++) {
+            bins[axis][i] = SpatialBin{ BoundingBox(), 0, 0 };
+        }
+    }
+
+    // References are chopped at every bin plane they cross, each piece extends the bin it lies in.
+    for (uint32_t i = task.begin; i < task.end; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (scale[axis] == 0) {
+                continue;
+            }
+            uint32_t first = GetBin(GetAxis(references[i].bounds.min, axis), min[axis], scale[axis], binsCount);
+            uint32_t last = GetBin(GetAxis(references[i].bounds.max, axis), min[axis], scale[axis], binsCount);
+            auto reference = references[i];
+            for (uint32_t bin = first; bin < last; bin++) {
+                Reference left, right;
+                SplitReference(reference, axis, min[axis] + (bin + 1) / scale[axis], &left, &right);
+                bins[axis][bin].bounds.Extend(left.bounds);
+                reference = right;
+            }
+            bins[axis][last].bounds.Extend(reference.bounds);
+            bins[axis][first].entries++;
+            bins[axis][last].exits++;
+        }
+    }
+
+    bool found = false;
+    uint32_t count = task.end - task.begin;
+    split->cost = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0) {
+            continue;
+        }
+
+        BoundingBox bounds;
+        uint32_t rightCount = 0;
+        for (uint32_t i = binsCount - 1; i > 0; i--) {
+            bounds.Extend(bins[axis][i].bounds);
+            rightCount += bins[axis][i].exits;
+            scratch.rightBounds[i] = bounds;
+            scratch.rightCounts[i] = rightCount;
+        }
+
+        bounds = BoundingBox();
+        uint32_t leftCount = 0;
+        for (uint32_t i = 0; i < binsCount - 1; i++) {
+            bounds.Extend(bins[axis][i].bounds);
+            leftCount += bins[axis][i].entries;
+            rightCount = scratch.rightCounts[i + 1];
+            if (leftCount == 0 || rightCount == 0 || leftCount + rightCount - count > task.budget) {
+                continue;
+            }
+            float cost = bounds.GetSurfaceArea() * leftCount + scratch.rightBounds[i + 1].GetSurfaceArea() * rightCount;
+            if (cost < split->cost) {
+                split->axis = axis;
+                split->position = min[axis] + (i + 1) / scale[axis];
+                split->cost = cost;
+                found = true;
+            }
+        }
+    }
+
+    if (found) {
+        split->cost = TraversalCost + IntersectionCost * split->cost / task.bounds.GetSurfaceArea();
+    }
+
+    return found;
+}
+
+void BVHBuilder::SplitReference(const Reference& reference, int axis, float position, Reference* left, Reference* right) const
+{
+    left->bounds = right->bounds = BoundingBox();
+    left->primitive = right->primitive = reference.primitive;
+
+    auto vertices = triangles + reference.primitive * 3;
+    for (uint32_t i = 0; i < 3; i++) {
+        const auto& a = vertices[i];
+        const auto& b = vertices[(i + 1) % 3];
+        float positionA = GetAxis(a, axis), positionB = GetAxis(b, axis);
+
+        if (positionA <= position) {
+            left->bounds.Extend(a);
+        }
+        if (positionA >= position) {
+            right->bounds.Extend(a);
+        }
+        if ((positionA < position && positionB > position) || (positionA > position && positionB < position)) {
+            float t = (position - positionA) / (positionB - positionA);
+            Vector3 point{ a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t };
+            SetAxis(point, axis, position);
+            left->bounds.Extend(point);
+            right->bounds.Extend(point);
+        }
+    }
+
+    // The reference may already be a clipped piece of its triangle.
+    left->bounds.Clip(reference.bounds);
+    right->bounds.Clip(reference.bounds);
+}
+
+bool BVHBuilder::PerformSpatialSplit(const Task& task, const SpatialSplit& split, Task* left, Task* right) const
+{
+    std::vector<uint32_t> straddling;
+    left->references = std::make_shared<References>();
+    right->references = std::make_shared<References>();
+    BoundingBox leftBounds, rightBounds;
+
+    for (uint32_t i = task.begin; i < task.end; i++) {
+        const auto& reference = (*task.references)[i];
+        if (GetAxis(reference.bounds.max, split.axis) <= split.position) {
+            left->references->push_back(reference);
+            leftBounds.Extend(reference.bounds);
+        }
+        else if (GetAxis(reference.bounds.min, split.axis) >= split.position) {
+            right->references->push_back(reference);
+            rightBounds.Extend(reference.bounds);
+        }
+        else {
+            straddling.push_back(i);
+        }
+    }
+
+    // Straddling references are only duplicated when that is cheaper than moving them whole to one side.
+    for (auto index : straddling) {
+        const auto& reference = (*task.references)[index];
+        Reference leftPart, rightPart;
+        SplitReference(reference, split.axis, split.position, &leftPart, &rightPart);
+
+        float leftCount = left->references->size() + 1.0f;
+        float rightCount = right->references->size() + 1.0f;
+        BoundingBox leftWhole = leftBounds, rightWhole = rightBounds, leftSplit = leftBounds, rightSplit = rightBounds;
+        leftWhole.Extend(reference.bounds);
+        rightWhole.Extend(reference.bounds);
+        leftSplit.Extend(leftPart.bounds);
+        rightSplit.Extend(rightPart.bounds);
+
+        float splitCost = leftSplit.GetSurfaceArea() * leftCount + rightSplit.GetSurfaceArea() * rightCount;
+        float leftCost = leftWhole.GetSurfaceArea() * leftCount + rightBounds.GetSurfaceArea() * (rightCount - 1);
+        float rightCost = leftBounds.GetSurfaceArea() * (leftCount - 1) + rightWhole.GetSurfaceArea() * rightCount;
+
+        if (rightPart.bounds.IsEmpty() || (leftCost <= splitCost && leftCost <= rightCost && !leftPart.bounds.IsEmpty())) {
+            left->references->push_back(reference);
+            leftBounds = leftWhole;
+        }
+        else if (leftPart.bounds.IsEmpty() || rightCost <= splitCost) {
+            right->references->push_back(reference);
+            rightBounds = rightWhole;
+        }
+        else {
+            leftPart.center = leftPart.bounds.GetCenter();
+            rightPart.center = rightPart.bounds.GetCenter();
+            left->references->push_back(leftPart);
+            right->references->push_back(rightPart);
+            leftBounds = leftSplit;
+            rightBounds = rightSplit;
+        }
+    }
+
+    uint32_t count = task.end - task.begin;
+    uint32_t leftCount = left->references->size(), rightCount = right->references->size();
+    if (leftCount == 0 || rightCount == 0 || leftCount + rightCount - count > task.budget) {
+        return false;
+    }
+
+    for (auto child : { left, right }) {
+        child->begin = 0;
+        child->end = child->references->size();
+        child->bounds = child->centerBounds = BoundingBox();
+        for (const auto& reference : *child->references) {
+            child->bounds.Extend(reference.bounds);
+            child->centerBounds.Extend(reference.center);
+        }
+    }
+    return true;
+}
+
+void BVHBuilder::CreateLeaf(Task& task, BVHNode& node)
+{
+    node.count = task.end - task.begin;
+    if (!triangles) {
+        node.offset = task.begin;
+        return;
+    }
+
+    node.offset = primitivesCount.fetch_add(node.count);
+    for (uint32_t i = 0; i < node.count; i++) {
+        bvh->primitives[node.offset + i] = (*task.references)[task.begin + i].primitive;
+    }
+}
+
+void BVHBuilder::BuildNode(Task& task, Scratch& scratch)
+{
+    auto& node = bvh->nodes[task.node];
+    node.bounds = task.bounds;
+
+    uint32_t count = task.end - task.begin;
+    Split split;
+    bool canSplit = count > 1 && task.depth + 1 < BVH::MaxDepth;
+    bool hasSplit = canSplit && FindSplit(task, scratch, &split);
+    float cost = hasSplit ? split.cost : INFINITY;
+
+    SpatialSplit spatialSplit;
+    bool hasSpatialSplit = false;
+    if (canSplit && triangles && task.budget > 0) {
+        // Spatial splits only pay off where the children of the object split overlap noticeably.
+        BoundingBox overlap = split.leftBounds;
+        overlap.Clip(split.rightBounds);
+        if (!hasSplit || (!overlap.IsEmpty() && overlap.GetSurfaceArea() > SpatialSplitOverlap * rootArea)) {
+            hasSpatialSplit = FindSpatialSplit(task, scratch, &spatialSplit) && spatialSplit.cost < cost;
+        }
+    }
+    if (hasSpatialSplit) {
+        cost = spatialSplit.cost;
+    }
+
+    if (!canSplit || (count <= options.maxLeafSize && cost >= IntersectionCost * count)) {
+        CreateLeaf(task, node);
+        return;
+    }
+
+    uint32_t children = nodesCount.fetch_add(2);
+    node.offset = children;
+    node.count = 0;
+
+    Task left{ children, 0, 0, task.depth + 1, BoundingBox(), BoundingBox(), nullptr, 0 };
+    Task right{ children + 1, 0, 0, task.depth + 1, BoundingBox(), BoundingBox(), nullptr, 0 };
+
+    if (!hasSpatialSplit || !PerformSpatialSplit(task, spatialSplit, &left, &right)) {
+        auto references = task.references->data();
+        uint32_t middle;
+        if (hasSplit) {
+            float min = GetAxis(task.centerBounds.min, split.axis);
+            float scale = split.binsCount / (GetAxis(task.centerBounds.max, split.axis) - min);
+            auto iterator = std::partition(references + task.begin, references + task.end, [&](const Reference& reference) {
+                return GetBin(GetAxis(reference.center, split.axis), min, scale, split.binsCount) <= split.bin;
+            });
+            middle = iterator - references;
+        }
+        else {
+            middle = task.begin + count / 2;
+            split.leftBounds = split.rightBounds = task.bounds;
+            split.leftCenterBounds = split.rightCenterBounds = task.centerBounds;
+        }
+
+        left.bounds = split.leftBounds;
+        left.centerBounds = split.leftCenterBounds;
+        right.bounds = split.rightBounds;
+        right.centerBounds = split.rightCenterBounds;
+
+        left.references = right.references = task.references;
+        left.begin = task.begin;
+        left.end = middle;
+        right.begin = middle;
+        right.end = task.end;
+    }
+
+    uint32_t leftCount = left.end - left.begin, rightCount = right.end - right.begin;
+    if (triangles) {
+        uint32_t budget = task.budget - (leftCount + rightCount - count);
+        left.budget = (uint64_t)budget * leftCount / (leftCount + rightCount);
+        right.budget = budget - left.budget;
+    }
+    task.references.reset();
+
+    if (options.threadsCount > 1 && leftCount > ParallelThreshold) {
+        PushTask(std::move(left));
+    }
+    else {
+        BuildNode(left, scratch);
+    }
+
+    if (options.threadsCount > 1 && rightCount > ParallelThreshold) {
+        PushTask(std::move(right));
+    }
+    else {
+        BuildNode(right, scratch);
+    }
+}
+
+float BVHBuilder::CalculateCost() const
+{
+    if (bvh->nodes.empty()) {
+        return 0;
+    }
+
+    float cost = 0;
+    for (auto& node : bvh->nodes) {
+        float area = node.bounds.GetSurfaceArea();
+        cost += node.count > 0 ? IntersectionCost * node.count * area : TraversalCost * area;
+    }
+
+    float rootArea = bvh->nodes[0].bounds.GetSurfaceArea();
+    return rootArea > 0 ? cost / rootArea : cost;
+}
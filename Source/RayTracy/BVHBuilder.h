@@ -0,0 +1,128 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+
+#include "BVH.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+/*
+    Binned SAH builder. Nodes larger than ParallelThreshold are handed over to a pool of
+    worker threads, smaller subtrees are built recursively by the thread that created them.
+
+    Tasks partition a range of a shared reference array in place. A spatial split clips the
+    triangles crossing its plane into both children, so it moves them into two new arrays instead.
+    A node only tries one when the children of its best object split overlap by more than
+    SpatialSplitOverlap of the root area, and each task gets a share of the duplication budget
+    proportional to its references, which keeps the tree independent of thread timing.
+*/
+class BVHBuilder
+{
+private:
+    static const uint32_t MinBinsCount;
+    static const uint32_t MaxBinsCount;
+    static const uint32_t ParallelThreshold;
+    static const float TraversalCost;
+    static const float IntersectionCost;
+    static const float SpatialSplitOverlap;
+
+    struct Reference
+    {
+        BoundingBox bounds;
+        Vector3 center;
+        uint32_t primitive;
+    };
+
+    typedef std::vector<Reference> References;
+
+    struct Task
+    {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        uint32_t depth;
+        BoundingBox bounds;
+        BoundingBox centerBounds;
+        std::shared_ptr<References> references;
+        uint32_t budget;
+    };
+
+    struct Bin
+    {
+        BoundingBox bounds;
+        BoundingBox centerBounds;
+        uint32_t count;
+    };
+
+    struct SpatialBin
+    {
+        BoundingBox bounds;
+        uint32_t entries;
+        uint32_t exits;
+    };
+
+    struct Scratch
+    {
+        std::vector<Bin> bins;
+        std::vector<SpatialBin> spatialBins;
+        std::vector<BoundingBox> rightBounds, rightCenterBounds;
+        std::vector<uint32_t> rightCounts;
+    };
+
+    struct Split
+    {
+        int axis;
+        uint32_t bin;
+        uint32_t binsCount;
+        float cost;
+        BoundingBox leftBounds, rightBounds;
+        BoundingBox leftCenterBounds, rightCenterBounds;
+    };
+
+    struct SpatialSplit
+    {
+        int axis;
+        float position;
+        float cost;
+    };
+
+    BVHBuildOptions options;
+    std::shared_ptr<References> references;
+    const Vector3* triangles;
+    float rootArea;
+    BVH* bvh;
+    std::atomic<uint32_t> nodesCount;
+    std::atomic<uint32_t> primitivesCount;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<Task> tasks;
+    uint32_t pendingTasks;
+
+    void Worker();
+    void PushTask(Task&& task);
+    void BuildNode(Task& task, Scratch& scratch);
+    void CreateLeaf(Task& task, BVHNode& node);
+    bool FindSplit(const Task& task, Scratch& scratch, Split* split) const;
+    bool FindSpatialSplit(const Task& task, Scratch& scratch, SpatialSplit* split) const;
+    /*
+        Clips the triangle of a reference at an axis aligned plane. Only the bounds of the parts
+        are computed, their centers are left to the caller.
+    */
+    void SplitReference(const Reference& reference, int axis, float position, Reference* left, Reference* right) const;
+    bool PerformSpatialSplit(const Task& task, const SpatialSplit& split, Task* left, Task* right) const;
+    uint32_t GetBin(float center, float min, float scale, uint32_t binsCount) const;
+
+    float CalculateCost() const;
+
+public:
+    BVHBuilder(const BVHBuildOptions& options);
+
+    void Build(const std::vector<BoundingBox>& boxes, BVH* bvh, BVHBuildStatistics* statistics = nullptr, const Vector3* triangles = nullptr);
+
+    BVHBuilder(const BVHBuilder& other) = delete;
+    BVHBuilder& operator=(const BVHBuilder& other) = delete;
+};
+
+#endif
@@ -0,0 +1,339 @@
+#include "BVHCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <atomic>
+
+#ifdef PLATFORM_WINDOWS
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const uint32_t BVHCache::Magic = 0x48564252;
+const uint32_t BVHCache::Version = 1;
+const uint64_t BVHCache::HashSeed = 14695981039346656037ull;
+
+/*
+    Read only view of a whole file, empty when the file cannot be opened.
+*/
+class MappedFile
+{
+private:
+    const uint8_t* data;
+    size_t size;
+#ifdef PLATFORM_WINDOWS
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    const uint8_t* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+#ifdef PLATFORM_WINDOWS
+MappedFile::MappedFile(const std::string& path) :
+    data{ nullptr },
+    size{ 0 },
+    file{ INVALID_HANDLE_VALUE },
+    mapping{ nullptr }
+{
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        return;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        return;
+    }
+    data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    size = data ? (size_t)fileSize.QuadPart : 0;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+#else
+MappedFile::MappedFile(const std::string& path) :
+    data{ nullptr },
+    size{ 0 },
+    file{ open(path.c_str(), O_RDONLY) }
+{
+    struct stat fileStatus;
+    if (file < 0 || fstat(file, &fileStatus) != 0 || fileStatus.st_size == 0) {
+        return;
+    }
+    void* view = mmap(nullptr, fileStatus.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (view == MAP_FAILED) {
+        return;
+    }
+    data = (const uint8_t*)view;
+    size = fileStatus.st_size;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data) {
+        munmap((void*)data, size);
+    }
+    if (file >= 0) {
+        close(file);
+    }
+}
+#endif
+
+uint64_t BVHCache::Hash(const void* data, size_t size, uint64_t hash) const
+{
+    auto bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t BVHCache::GetKey(const void* vertices, size_t verticesSize, const void* indices, size_t indicesSize, const BVHBuildOptions& options) const
+{
+    uint32_t duplication = options.spatialSplits ? (uint32_t)(options.maxDuplication * 1000) + 1 : 0;
+    uint32_t parameters[] = { Version, options.binsCount, options.maxLeafSize, (uint32_t)options.layout, duplication, (uint32_t)options.nodeOrder };
+    uint64_t hash = Hash(parameters, sizeof(parameters), HashSeed);
+    hash = Hash(&verticesSize, sizeof(verticesSize), hash);
+    hash = Hash(vertices, verticesSize, hash);
+    hash = Hash(&indicesSize, sizeof(indicesSize), hash);
+    return Hash(indices, indicesSize, hash);
+}
+
+template<typename Node>
+bool BVHCache::ReadNodes(const Header& header, const uint8_t* data, size_t size, std::vector<Node>* nodes) const
+{
+    size_t nodesSize = (size_t)header.nodesCount * sizeof(Node);
+    size_t primitivesSize = (size_t)header.primitivesCount * sizeof(uint32_t);
+    if (header.nodeSize != sizeof(Node) || size != sizeof(Header) + nodesSize + primitivesSize) {
+        return false;
+    }
+    nodes->resize(header.nodesCount);
+    memcpy(nodes->data(), data + sizeof(Header), nodesSize);
+    return true;
+}
+
+template<typename Node>
+bool BVHCache::ValidateNodes(const std::vector<Node>& nodes, uint32_t primitivesCount) const
+{
+    if (nodes.empty()) {
+        return true;
+    }
+
+    // Without shared or cyclic references no node is reached twice, which also ends the walk.
+    std::vector<std::pair<uint32_t, uint32_t>> stack(1, std::make_pair(0u, 0u));
+    uint32_t visitedCount = 0;
+    while (!stack.empty()) {
+        uint32_t node = stack.back().first, depth = stack.back().second;
+        stack.pop_back();
+        if (++visitedCount > nodes.size() || depth >= BVH::MaxDepth) {
+            return false;
+        }
+
+        uint32_t children[8], counts[8], childrenCount;
+        if (!GetNodeChildren(nodes[node], children, counts, &childrenCount)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < childrenCount; i++) {
+            if (counts[i] > 0) {
+                if ((uint64_t)children[i] + counts[i] > primitivesCount) {
+                    return false;
+                }
+            }
+            else if (children[i] >= nodes.size()) {
+                return false;
+            }
+            else {
+                stack.push_back(std::make_pair(children[i], depth + 1));
+            }
+        }
+    }
+    return true;
+}
+
+bool BVHCache::GetNodeChildren(const BVHNode& node, uint32_t* children, uint32_t* counts, uint32_t* childrenCount) const
+{
+    if (node.count > 0) {
+        children[0] = node.offset;
+        counts[0] = node.count;
+        *childrenCount = 1;
+        return true;
+    }
+    // Inner nodes reference their two children as a pair starting at offset.
+    if (node.offset == UINT32_MAX) {
+        return false;
+    }
+    children[0] = node.offset;
+    children[1] = node.offset + 1;
+    counts[0] = counts[1] = 0;
+    *childrenCount = 2;
+    return true;
+}
+
+template<typename Node>
+bool BVHCache::GetNodeChildren(const Node& node, uint32_t* children, uint32_t* counts, uint32_t* childrenCount) const
+{
+    if (node.childrenCount > Node::Arity) {
+        return false;
+    }
+    GetChildren(node, children, counts);
+    *childrenCount = node.childrenCount;
+    return true;
+}
+
+template<typename Node>
+void BVHCache::WriteHeader(Header* header, const std::vector<Node>& nodes) const
+{
+    header->nodeSize = sizeof(Node);
+    header->nodesCount = nodes.size();
+}
+
+bool BVHCache::Load(const std::string& path, uint64_t key, uint32_t trianglesCount, BVH* bvh, BVHBuildStatistics* statistics) const
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    MappedFile file(path);
+    if (file.GetSize() < sizeof(Header)) {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, file.GetData(), sizeof(Header));
+    if (header.magic != Magic || header.version != Version || header.key != key) {
+        return false;
+    }
+
+    bvh->Clear();
+    bool result = false;
+    switch ((BVHLayout)header.layout) {
+    case BVHLayout::Binary:
+        result = ReadNodes(header, file.GetData(), file.GetSize(), &bvh->nodes) && ValidateNodes(bvh->nodes, header.primitivesCount);
+        break;
+    case BVHLayout::Wide4:
+        result = ReadNodes(header, file.GetData(), file.GetSize(), &bvh->wideNodes4) && ValidateNodes(bvh->wideNodes4, header.primitivesCount);
+        break;
+    case BVHLayout::Wide8:
+        result = ReadNodes(header, file.GetData(), file.GetSize(), &bvh->wideNodes8) && ValidateNodes(bvh->wideNodes8, header.primitivesCount);
+        break;
+    case BVHLayout::Compressed8:
+        result = ReadNodes(header, file.GetData(), file.GetSize(), &bvh->compressedNodes) && ValidateNodes(bvh->compressedNodes, header.primitivesCount);
+        break;
+    }
+    if (!result) {
+        bvh->Clear();
+        return false;
+    }
+
+    bvh->layout = (BVHLayout)header.layout;
+    bvh->bounds = BoundingBox(Vector3{ header.bounds[0], header.bounds[1], header.bounds[2] }, Vector3{ header.bounds[3], header.bounds[4], header.bounds[5] });
+    bvh->primitives.resize(header.primitivesCount);
+    memcpy(bvh->primitives.data(), file.GetData() + file.GetSize() - header.primitivesCount * sizeof(uint32_t), header.primitivesCount * sizeof(uint32_t));
+    for (auto primitive : bvh->primitives) {
+        if (primitive >= trianglesCount) {
+            bvh->Clear();
+            return false;
+        }
+    }
+
+    if (statistics) {
+        statistics->buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+        statistics->sahCost = header.sahCost;
+        statistics->nodesCount = bvh->GetNodesCount();
+        statistics->nodesSize = bvh->GetNodesSize();
+        statistics->referencesCount = header.primitivesCount;
+    }
+    return true;
+}
+
+bool BVHCache::Save(const std::string& path, uint64_t key, const BVH& bvh, const BVHBuildStatistics& statistics) const
+{
+    Header header = {};
+    header.magic = Magic;
+    header.version = Version;
+    header.key = key;
+    header.layout = (uint32_t)bvh.layout;
+    header.bounds[0] = bvh.bounds.min.x;
+    header.bounds[1] = bvh.bounds.min.y;
+    header.bounds[2] = bvh.bounds.min.z;
+    header.bounds[3] = bvh.bounds.max.x;
+    header.bounds[4] = bvh.bounds.max.y;
+    header.bounds[5] = bvh.bounds.max.z;
+    header.sahCost = statistics.sahCost;
+    header.primitivesCount = bvh.primitives.size();
+
+    const void* nodes;
+    switch (bvh.layout) {
+    case BVHLayout::Wide4:
+        WriteHeader(&header, bvh.wideNodes4);
+        nodes = bvh.wideNodes4.data();
+        break;
+    case BVHLayout::Wide8:
+        WriteHeader(&header, bvh.wideNodes8);
+        nodes = bvh.wideNodes8.data();
+        break;
+    case BVHLayout::Compressed8:
+        WriteHeader(&header, bvh.compressedNodes);
+        nodes = bvh.compressedNodes.data();
+        break;
+    default:
+        WriteHeader(&header, bvh.nodes);
+        nodes = bvh.nodes.data();
+        break;
+    }
+
+    // The file is written under a temporary name first, so that an interrupted write or
+    // another instance reading the cache never sees a partial file. The name is unique to the
+    // process and the call, instances saving the same hierarchy never write the same file.
+    static std::atomic<uint32_t> savesCount{ 0 };
+#ifdef PLATFORM_WINDOWS
+    auto processId = (uint32_t)GetCurrentProcessId();
+#else
+    auto processId = (uint32_t)getpid();
+#endif
+    auto temporaryPath = path + "." + std::to_string(processId) + "." + std::to_string(savesCount++) + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool result = fwrite(&header, sizeof(Header), 1, file) == 1;
+    if (header.nodesCount > 0) {
+        result = result && fwrite(nodes, header.nodeSize, header.nodesCount, file) == header.nodesCount;
+    }
+    if (header.primitivesCount > 0) {
+        result = result && fwrite(bvh.primitives.data(), sizeof(uint32_t), header.primitivesCount, file) == header.primitivesCount;
+    }
+    result = fclose(file) == 0 && result;
+
+#ifdef PLATFORM_WINDOWS
+    remove(path.c_str());
+#endif
+    if (!result || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
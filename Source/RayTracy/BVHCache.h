@@ -0,0 +1,62 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "BVH.h"
+#include <string>
+
+/*
+    Stores built hierarchies on disk. A cache file is only used when its key matches, the key
+    covers the source geometry, the builder options and the file format version.
+*/
+class BVHCache
+{
+private:
+    static const uint32_t Magic;
+    static const uint32_t Version;
+    static const uint64_t HashSeed;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t key;
+        uint32_t layout;
+        uint32_t nodeSize;
+        uint32_t nodesCount;
+        uint32_t primitivesCount;
+        float bounds[6];
+        float sahCost;
+        uint32_t padding;
+    };
+
+    uint64_t Hash(const void* data, size_t size, uint64_t hash) const;
+
+    template<typename Node>
+    bool ReadNodes(const Header& header, const uint8_t* data, size_t size, std::vector<Node>* nodes) const;
+
+    /*
+        Walks the tree from the root and fails when a child index or a leaf range is out of bounds,
+        a node is reached twice or the tree is deeper than the traversal stacks.
+    */
+    template<typename Node>
+    bool ValidateNodes(const std::vector<Node>& nodes, uint32_t primitivesCount) const;
+
+    bool GetNodeChildren(const BVHNode& node, uint32_t* children, uint32_t* counts, uint32_t* childrenCount) const;
+
+    template<typename Node>
+    bool GetNodeChildren(const Node& node, uint32_t* children, uint32_t* counts, uint32_t* childrenCount) const;
+
+    template<typename Node>
+    void WriteHeader(Header* header, const std::vector<Node>& nodes) const;
+
+public:
+    uint64_t GetKey(const void* vertices, size_t verticesSize, const void* indices, size_t indicesSize, const BVHBuildOptions& options) const;
+    /*
+        Fails for a file whose nodes do not form a valid tree over its primitives, or whose
+        primitive references are not all below trianglesCount.
+    */
+    bool Load(const std::string& path, uint64_t key, uint32_t trianglesCount, BVH* bvh, BVHBuildStatistics* statistics = nullptr) const;
+    bool Save(const std::string& path, uint64_t key, const BVH& bvh, const BVHBuildStatistics& statistics) const;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#include "BoundingBox.h"
+
+BoundingBox::BoundingBox(Vector3 min, Vector3 max) :
+    min(min),
+    max(max)
+{
+}
+
+Vector3 BoundingBox::GetCenter() const
+{
+    return Vector3{ (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f };
+}
+
+BoundingBox BoundingBox::Transform(const Matrix4& matrix) const
+{
+    BoundingBox result;
+    if (IsEmpty()) {
+        return result;
+    }
+    for (uint32_t i = 0; i < 8; i++) {
+        Vector3 corner{ i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z };
+        result.Extend(matrix * corner);
+    }
+    return result;
+}
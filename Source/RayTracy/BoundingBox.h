@@ -0,0 +1,106 @@
+#ifndef BOUNDING_BOX_H
+#define BOUNDING_BOX_H
+
+#include "Vector.h"
+#include "Matrix.h"
+#include <math.h>
+
+inline float Min(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+inline float Max(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+inline float GetAxis(const Vector3& vector, int axis)
+{
+    return axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z);
+}
+
+inline void SetAxis(Vector3& vector, int axis, float value)
+{
+    (axis == 0 ? vector.x : (axis == 1 ? vector.y : vector.z)) = value;
+}
+
+struct BoundingBox
+{
+    Vector3 min, max;
+
+    BoundingBox(Vector3 min, Vector3 max);
+
+    inline BoundingBox()
+    {
+        min.x = min.y = min.z = INFINITY;
+        max.x = max.y = max.z = -INFINITY;
+    }
+
+    Vector3 GetCenter() const;
+    BoundingBox Transform(const Matrix4& matrix) const;
+
+    inline void Extend(const Vector3& point)
+    {
+        min.x = Min(min.x, point.x);
+        min.y = Min(min.y, point.y);
+        min.z = Min(min.z, point.z);
+        max.x = Max(max.x, point.x);
+        max.y = Max(max.y, point.y);
+        max.z = Max(max.z, point.z);
+    }
+
+    inline void Extend(const BoundingBox& other)
+    {
+        min.x = Min(min.x, other.min.x);
+        min.y = Min(min.y, other.min.y);
+        min.z = Min(min.z, other.min.z);
+        max.x = Max(max.x, other.max.x);
+        max.y = Max(max.y, other.max.y);
+        max.z = Max(max.z, other.max.z);
+    }
+
+    inline void Clip(const BoundingBox& other)
+    {
+        min.x = Max(min.x, other.min.x);
+        min.y = Max(min.y, other.min.y);
+        min.z = Max(min.z, other.min.z);
+        max.x = Min(max.x, other.max.x);
+        max.y = Min(max.y, other.max.y);
+        max.z = Min(max.z, other.max.z);
+    }
+
+    inline bool IsEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    inline float GetSurfaceArea() const
+    {
+        if (IsEmpty()) {
+            return 0;
+        }
+        float dx = max.x - min.x;
+        float dy = max.y - min.y;
+        float dz = max.z - min.z;
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    inline bool HasIntersection(const Vector3& origin, const Vector3& inverseDirection, float maxDistance, float* distance) const
+    {
+        float x1 = (min.x - origin.x) * inverseDirection.x;
+        float x2 = (max.x - origin.x) * inverseDirection.x;
+        float y1 = (min.y - origin.y) * inverseDirection.y;
+        float y2 = (max.y - origin.y) * inverseDirection.y;
+        float z1 = (min.z - origin.z) * inverseDirection.z;
+        float z2 = (max.z - origin.z) * inverseDirection.z;
+
+        float entryDistance = Max(Max(Min(x1, x2), Min(y1, y2)), Max(Min(z1, z2), 0.0f));
+        float exitDistance = Min(Min(Max(x1, x2), Max(y1, y2)), Min(Max(z1, z2), maxDistance));
+
+        *distance = entryDistance;
+        return entryDistance <= exitDistance;
+    }
+};
+
+#endif
@@ -53,7 +53,13 @@ bool RayTriangleIntersection(Vector3 a, Vector3 b, Vector3 c, Ray ray, float* t,
     return true;
 }
 
-bool Sphere::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v)
+bool Object::IsOccluded(Ray ray, float maxDistance) const
+{
+    float distance;
+    return HasIntersection(ray, &distance) && distance < maxDistance;
+}
+
+bool Sphere::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v) const
 {
     Vector3 L = center - ray.origin;
     float tca = Dot(L, ray.direction);
@@ -63,13 +69,14 @@ bool Sphere::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float
     }
 
     float l = L.GetLength();
-    float d = sqrtf(l * l - tca * tca);
+    // Rounding can make the squared distance slightly negative for rays through the center.
+    float d2 = Max(l * l - tca * tca, 0.0f);
 
-    if (d < 0 || d > radius) {
+    if (d2 > radius * radius) {
         return false;
     }
 
-    float thc = sqrtf(radius * radius - d * d);
+    float thc = sqrtf(radius * radius - d2);
     float distance = l < radius ? tca + thc : tca - thc;
 
     if (t) {
@@ -94,6 +101,12 @@ bool Sphere::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float
     return true;
 }
 
+bool Sphere::GetBoundingBox(BoundingBox* box) const
+{
+    *box = BoundingBox(center - Vector3{ radius, radius, radius }, center + Vector3{ radius, radius, radius });
+    return true;
+}
+
 void GetPlaneUV(Vector3 p0, Vector3 p, Vector3 n, float* outU, float* outV)
 {
     Vector3 U, V;
@@ -115,7 +128,7 @@ void GetPlaneUV(Vector3 p0, Vector3 p, Vector3 n, float* outU, float* outV)
     *outV = (l * l - m * m + 1) / 2;
 }
 
-bool Plane::HasIntersection(Ray ray, float* t, Vector3* intersectionNormal, float* u, float* v)
+bool Plane::HasIntersection(Ray ray, float* t, Vector3* intersectionNormal, float* u, float* v) const
 {
     float d = Dot(ray.direction, normal);
 
@@ -147,7 +160,12 @@ bool Plane::HasIntersection(Ray ray, float* t, Vector3* intersectionNormal, floa
     return true;
 }
 
-bool Disk::HasIntersection(Ray ray, float* t, Vector3* intersectionNormal, float* u, float* v)
+bool Plane::GetBoundingBox(BoundingBox*) const
+{
+    return false;
+}
+
+bool Disk::HasIntersection(Ray ray, float* t, Vector3* intersectionNormal, float* u, float* v) const
 {
     float distanceToPlane;
 
@@ -167,12 +185,62 @@ bool Disk::HasIntersection(Ray ray, float* t, Vector3* intersectionNormal, float
     return true;
 }
 
-bool Triangle::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v)
+bool Disk::GetBoundingBox(BoundingBox* box) const
+{
+    Vector3 extent
+    {
+        radius * sqrtf(fmaxf(0.0f, 1 - normal.x * normal.x)),
+        radius * sqrtf(fmaxf(0.0f, 1 - normal.y * normal.y)),
+        radius * sqrtf(fmaxf(0.0f, 1 - normal.z * normal.z))
+    };
+    *box = BoundingBox(point - extent, point + extent);
+    return true;
+}
+
+bool Triangle::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v) const
 {
     return RayTriangleIntersection(a, b, c, ray, t, normal, u, v);
 }
 
-Mesh::Mesh() : 
+bool Triangle::GetBoundingBox(BoundingBox* box) const
+{
+    *box = BoundingBox();
+    box->Extend(a);
+    box->Extend(b);
+    box->Extend(c);
+    return true;
+}
+
+const float TriangleRecords::MinDeterminant = 1e-12f;
+
+void TriangleRecords::Resize(uint32_t count)
+{
+    for (auto values : { &ax, &ay, &az, &abx, &aby, &abz, &acx, &acy, &acz, &nx, &ny, &nz }) {
+        values->assign(count, 0.0f);
+    }
+}
+
+void TriangleRecords::Set(uint32_t triangle, Vector3 a, Vector3 b, Vector3 c)
+{
+    auto ab = b - a;
+    auto ac = c - a;
+    auto n = Cross(ab, ac);
+
+    ax[triangle] = a.x;
+    ay[triangle] = a.y;
+    az[triangle] = a.z;
+    abx[triangle] = ab.x;
+    aby[triangle] = ab.y;
+    abz[triangle] = ab.z;
+    acx[triangle] = ac.x;
+    acy[triangle] = ac.y;
+    acz[triangle] = ac.z;
+    nx[triangle] = n.x;
+    ny[triangle] = n.y;
+    nz[triangle] = n.z;
+}
+
+MeshData::MeshData() : 
     verticesCount{ 0 }, 
     indicesCount{ 0 }, 
     indices{nullptr}, 
@@ -181,60 +249,122 @@ Mesh::Mesh() :
 {
 }
 
-Mesh::Mesh(Mesh&& other)
+void MeshData::Resize(uint32_t verticesCount, uint32_t indicesCount, bool hasTextureCoordinates)
 {
-    vertices = other.vertices;
-    indices = other.indices;
-    textureCoordinates = other.textureCoordinates;
-    verticesCount = other.verticesCount;
-    indicesCount = other.indicesCount;
-
-    other.vertices = nullptr;
-    other.indices = nullptr;
-    other.textureCoordinates = nullptr;
+    if (vertices) {
+        delete[] vertices;
+    }
+    if (indices) {
+        delete[] indices;
+    }
+    if (textureCoordinates) {
+        delete[] textureCoordinates;
+    }
+    this->verticesCount = verticesCount;
+    this->indicesCount = indicesCount;
+    vertices = new Vector3[verticesCount];
+    indices = new uint32_t[indicesCount];
+    if (hasTextureCoordinates) {
+        textureCoordinates = new Vector2[verticesCount];
+    }
 }
 
-bool Mesh::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v)
+void MeshData::BuildHierarchy(const BVHBuildOptions& options, BVHBuildStatistics* statistics)
 {
-    bool hasIntersection = false;
-    float minDistance = INFINITY, distance, minU, minV, cu, cv;
-    Vector3 minN, n;
-
-    ray.origin = scaleMatrix * rotationMatrix * translationMatrix * ray.origin;
-    ray.direction = scaleMatrix * rotationMatrix * ray.direction;
-
-    for (uint32_t i = 0; i < indicesCount; i += 3) {
-        uint32_t indexA = indices[i], indexB = indices[i + 1], indexC = indices[i + 2];
+    std::vector<BoundingBox> boxes(indicesCount / 3);
+    std::vector<Vector3> triangleVertices(options.spatialSplits ? indicesCount : 0);
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        uint32_t indexA = indices[i * 3], indexB = indices[i * 3 + 1], indexC = indices[i * 3 + 2];
 
         if (indexA >= verticesCount || indexB >= verticesCount || indexC >= verticesCount) {
             continue;
         }
 
-        auto a = vertices[indexA];
-        auto b = vertices[indexB];
-        auto c = vertices[indexC];
-
-        if (RayTriangleIntersection(a, b, c, ray, &distance, &n, &cu, &cv)) {
-            hasIntersection = true;
-            if (distance < minDistance) {
-                minDistance = distance;
-                minN = n;
-                if (textureCoordinates) {
-                    auto t1 = textureCoordinates[indexA];
-                    auto t2 = textureCoordinates[indexB];
-                    auto t3 = textureCoordinates[indexC];
-                    auto t = t1 * (1 - cu - cv) + t2 * cu + t3 * cv;
-                    minU = t.x;
-                    minV = 1 - t.y;
-                }
-                else {
-                    minU = cu;
-                    minV = cv;
-                }
-            }
+        boxes[i].Extend(vertices[indexA]);
+        boxes[i].Extend(vertices[indexB]);
+        boxes[i].Extend(vertices[indexC]);
+
+        if (options.spatialSplits) {
+            triangleVertices[i * 3] = vertices[indexA];
+            triangleVertices[i * 3 + 1] = vertices[indexB];
+            triangleVertices[i * 3 + 2] = vertices[indexC];
+        }
+    }
+    hierarchy.Build(boxes, options, statistics, options.spatialSplits ? triangleVertices.data() : nullptr);
+}
+
+void MeshData::BuildTriangles()
+{
+    std::vector<uint32_t> order;
+    hierarchy.RenumberPrimitives(&order);
+
+    uint32_t trianglesCount = order.size();
+    auto sortedIndices = new uint32_t[trianglesCount * 3];
+    triangles.Resize(trianglesCount);
+
+    for (uint32_t i = 0; i < trianglesCount; i++) {
+        for (uint32_t j = 0; j < 3; j++) {
+            sortedIndices[i * 3 + j] = indices[order[i] * 3 + j];
+        }
+
+        uint32_t indexA = sortedIndices[i * 3], indexB = sortedIndices[i * 3 + 1], indexC = sortedIndices[i * 3 + 2];
+        if (indexA < verticesCount && indexB < verticesCount && indexC < verticesCount) {
+            triangles.Set(i, vertices[indexA], vertices[indexB], vertices[indexC]);
         }
     }
 
+    delete[] indices;
+    indices = sortedIndices;
+    indicesCount = trianglesCount * 3;
+}
+
+MeshData::~MeshData()
+{
+    if (vertices) {
+        delete[] vertices;
+    }
+    if (indices) {
+        delete[] indices;
+    }
+    if (textureCoordinates) {
+        delete[] textureCoordinates;
+    }
+}
+
+Mesh::Mesh() :
+    data{ std::make_shared<MeshData>() }
+{
+}
+
+bool Mesh::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v) const
+{
+    const auto& triangles = data->triangles;
+    float minDistance = INFINITY, minU, minV;
+    uint32_t minTriangle;
+    auto worldDirection = ray.direction;
+
+    Vector3 inverseDirection{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+    float boundsDistance;
+    if (!worldBounds.HasIntersection(ray.origin, inverseDirection, INFINITY, &boundsDistance)) {
+        return false;
+    }
+
+    ray.origin = worldToObjectMatrix * ray.origin;
+    ray.direction = worldToObjectMatrix.TransformDirection(ray.direction);
+
+    bool hasIntersection = data->hierarchy.Intersect(ray.origin, ray.direction, INFINITY, [&](uint32_t triangle, float& maxDistance) {
+        float distance, cu, cv;
+        if (!triangles.Intersect(triangle, ray, &distance, &cu, &cv) || distance >= maxDistance) {
+            return false;
+        }
+
+        maxDistance = minDistance = distance;
+        minTriangle = triangle;
+        minU = cu;
+        minV = cv;
+        return true;
+    });
+
     if (!hasIntersection) {
         return false;
     }
@@ -244,7 +374,20 @@ bool Mesh::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float*
     }
 
     if (normal) {
-        *normal = minN;
+        Vector3 n{ triangles.nx[minTriangle], triangles.ny[minTriangle], triangles.nz[minTriangle] };
+        n = worldToObjectMatrix.TransformNormal(n);
+        n.Normalize();
+        *normal = GetOppositeNormal(n, worldDirection);
+    }
+
+    if (data->textureCoordinates) {
+        const auto& indices = data->indices;
+        auto t1 = data->textureCoordinates[indices[minTriangle * 3]];
+        auto t2 = data->textureCoordinates[indices[minTriangle * 3 + 1]];
+        auto t3 = data->textureCoordinates[indices[minTriangle * 3 + 2]];
+        auto uv = t1 * (1 - minU - minV) + t2 * minU + t3 * minV;
+        minU = uv.x;
+        minV = 1 - uv.y;
     }
 
     if (u) {
@@ -258,42 +401,40 @@ bool Mesh::HasIntersection(Ray ray, float* t, Vector3* normal, float* u, float*
     return true;
 }
 
-void Mesh::Resize(uint32_t verticesCount, uint32_t indicesCount, bool hasTextureCoordinates)
+bool Mesh::IsOccluded(Ray ray, float maxDistance) const
 {
-    if (vertices) {
-        delete[] vertices;
-    }
-    if (indices) {
-        delete[] indices;
-    }
-    if (textureCoordinates) {
-        delete[] textureCoordinates;
-    }
-    this->verticesCount = verticesCount;
-    this->indicesCount = indicesCount;
-    vertices = new Vector3[verticesCount];
-    indices = new uint32_t[indicesCount];
-    if (hasTextureCoordinates) {
-        textureCoordinates = new Vector2[verticesCount];
+    Vector3 inverseDirection{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+    float boundsDistance;
+    if (!worldBounds.HasIntersection(ray.origin, inverseDirection, maxDistance, &boundsDistance)) {
+        return false;
     }
+
+    ray.origin = worldToObjectMatrix * ray.origin;
+    ray.direction = worldToObjectMatrix.TransformDirection(ray.direction);
+
+    const auto& triangles = data->triangles;
+    return data->hierarchy.IsOccluded(ray.origin, ray.direction, maxDistance, [&](uint32_t triangle, float maxDistance) {
+        float distance, u, v;
+        return triangles.Intersect(triangle, ray, &distance, &u, &v) && distance < maxDistance;
+    });
 }
 
-void Mesh::SetTransformation(Vector3 position, Vector3 rotation, float scale)
+bool Mesh::GetBoundingBox(BoundingBox* box) const
 {
-    rotationMatrix = Matrix4::RotationX(-rotation.x) * Matrix4::RotationZ(-rotation.z) * Matrix4::RotationY(-rotation.y);
-    translationMatrix = Matrix4::Translation(-position.x, -position.y, -position.z);
-    scaleMatrix = Matrix4::Scale(1.0f / scale, 1.0f / scale, 1.0f / scale);
+    if (worldBounds.IsEmpty()) {
+        return false;
+    }
+    *box = worldBounds;
+    return true;
 }
 
-Mesh::~Mesh()
+void Mesh::SetTransformation(Vector3 position, Vector3 rotation, float scale)
 {
-    if (vertices) {
-        delete[] vertices;
-    }
-    if (indices) {
-        delete[] indices;
-    }
-    if (textureCoordinates) {
-        delete[] textureCoordinates;
-    }
+    worldToObjectMatrix = Matrix4::Scale(1.0f / scale, 1.0f / scale, 1.0f / scale) *
+        Matrix4::RotationX(-rotation.x) * Matrix4::RotationZ(-rotation.z) * Matrix4::RotationY(-rotation.y) *
+        Matrix4::Translation(-position.x, -position.y, -position.z);
+    objectToWorldMatrix = Matrix4::Translation(position.x, position.y, position.z) *
+        Matrix4::RotationY(rotation.y) * Matrix4::RotationZ(rotation.z) * Matrix4::RotationX(rotation.x) *
+        Matrix4::Scale(scale, scale, scale);
+    worldBounds = data->hierarchy.IsEmpty() ? BoundingBox() : data->hierarchy.GetBounds().Transform(objectToWorldMatrix);
 }
@@ -3,7 +3,11 @@
 
 #include "Vector.h"
 #include "Matrix.h"
+#include "BVH.h"
 #include <stdint.h>
+#include <memory>
+#include <vector>
+#include <math.h>
 
 #define PI 3.141592653589
 
@@ -39,7 +43,9 @@ struct Object
     Material material;
 
     Object() {};
-    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) = 0;
+    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) const = 0;
+    virtual bool IsOccluded(Ray ray, float maxDistance) const;
+    virtual bool GetBoundingBox(BoundingBox* box) const = 0;
     virtual ~Object() {};
 };
 
@@ -54,7 +60,8 @@ struct Sphere : public Object
         radius = 0;
     }
 
-    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) override;
+    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) const override;
+    virtual bool GetBoundingBox(BoundingBox* box) const override;
 };
 
 struct Plane : public Object
@@ -67,37 +74,98 @@ struct Plane : public Object
         normal = {};
     }
 
-    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) override;
+    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) const override;
+    virtual bool GetBoundingBox(BoundingBox* box) const override;
 };
 
 struct Disk : public Plane
 {
     float radius;
 
-    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) override;
+    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) const override;
+    virtual bool GetBoundingBox(BoundingBox* box) const override;
 };
 
 struct Triangle : public Object
 {
     Vector3 a, b, c;
 
-    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) override;
+    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) const override;
+    virtual bool GetBoundingBox(BoundingBox* box) const override;
 };
 
-struct Mesh : public Object
+/*
+    Mesh triangles in the order of the hierarchy leaves. The first vertex, both edges and the
+    unnormalized normal are stored as separate arrays, so a leaf test reads them linearly and
+    needs a single cross product per triangle.
+*/
+struct TriangleRecords
+{
+    static const float MinDeterminant;
+
+    std::vector<float> ax, ay, az;
+    std::vector<float> abx, aby, abz;
+    std::vector<float> acx, acy, acz;
+    std::vector<float> nx, ny, nz;
+
+    void Resize(uint32_t count);
+    void Set(uint32_t triangle, Vector3 a, Vector3 b, Vector3 c);
+
+    inline bool Intersect(uint32_t triangle, const Ray& ray, float* t, float* u, float* v) const
+    {
+        const auto& origin = ray.origin;
+        const auto& direction = ray.direction;
+
+        float determinant = -(direction.x * nx[triangle] + direction.y * ny[triangle] + direction.z * nz[triangle]);
+        if (fabsf(determinant) < MinDeterminant) {
+            return false;
+        }
+        float inverseDeterminant = 1.0f / determinant;
+
+        float tx = origin.x - ax[triangle], ty = origin.y - ay[triangle], tz = origin.z - az[triangle];
+        float qx = ty * direction.z - tz * direction.y;
+        float qy = tz * direction.x - tx * direction.z;
+        float qz = tx * direction.y - ty * direction.x;
+
+        float hitU = (qx * acx[triangle] + qy * acy[triangle] + qz * acz[triangle]) * inverseDeterminant;
+        if (hitU < 0 || hitU > 1) {
+            return false;
+        }
+
+        float hitV = -(qx * abx[triangle] + qy * aby[triangle] + qz * abz[triangle]) * inverseDeterminant;
+        if (hitV < 0 || hitU + hitV > 1) {
+            return false;
+        }
+
+        float distance = (tx * nx[triangle] + ty * ny[triangle] + tz * nz[triangle]) * inverseDeterminant;
+        if (distance < 0) {
+            return false;
+        }
+
+        *t = distance;
+        *u = hitU;
+        *v = hitV;
+        return true;
+    }
+};
+
+/*
+    Triangle data with its hierarchy in object space, shared by all meshes that reference the
+    same geometry.
+*/
+struct MeshData
 {
     Vector3* vertices;
     Vector2* textureCoordinates;
     uint32_t* indices;
     uint32_t indicesCount;
     uint32_t verticesCount;
-    Matrix4 rotationMatrix, translationMatrix, scaleMatrix;
+    BVH hierarchy;
+    TriangleRecords triangles;
 
-    Mesh();
-    Mesh(Mesh&& other);
-    Mesh(const Mesh& other) = delete;
-
-    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) override;
+    MeshData();
+    MeshData(const MeshData& other) = delete;
+    MeshData& operator=(const MeshData& other) = delete;
 
     void Resize(uint32_t verticesCount, uint32_t indicesCount, bool hasTextureCoordinates);
 
@@ -116,9 +184,37 @@ struct Mesh : public Object
         textureCoordinates[index] = value;
     }
 
-    void SetTransformation(Vector3 position, Vector3 rotation, float scale);
+    void BuildHierarchy(const BVHBuildOptions& options = BVHBuildOptions(), BVHBuildStatistics* statistics = nullptr);
 
-    ~Mesh();
+    /*
+        Renumbers the triangles in hierarchy order and fills the triangle records. Must be
+        called once the hierarchy is built or loaded. Triangles referenced by several leaves of
+        a spatial split hierarchy are stored once per reference.
+    */
+    void BuildTriangles();
+
+    ~MeshData();
+};
+
+struct Mesh : public Object
+{
+    std::shared_ptr<MeshData> data;
+
+    /*
+        Both affine transforms are composed once per transformation change. The world bounds
+        enclose the transformed hierarchy root and reject missing rays before any transform, so
+        they are refreshed by SetTransformation and it must be called after the hierarchy exists.
+    */
+    Matrix4 worldToObjectMatrix, objectToWorldMatrix;
+    BoundingBox worldBounds;
+
+    Mesh();
+
+    virtual bool HasIntersection(Ray ray, float* t = 0, Vector3* normal = 0, float* u = 0, float* v = 0) const override;
+    virtual bool IsOccluded(Ray ray, float maxDistance) const override;
+    virtual bool GetBoundingBox(BoundingBox* box) const override;
+
+    void SetTransformation(Vector3 position, Vector3 rotation, float scale);
 };
 
 
@@ -0,0 +1,186 @@
+#include "GridAccelerator.h"
+#include <math.h>
+
+const float GridAccelerator::CellsPerPrimitive = 4;
+const uint32_t GridAccelerator::MaxResolution = 128;
+
+GridAccelerator::GridAccelerator() :
+    resolution{ 0, 0, 0 },
+    cellSize{ 0, 0, 0 }
+{
+}
+
+void GridAccelerator::GetCellRange(const BoundingBox& box, uint32_t* first, uint32_t* last) const
+{
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float origin = GetAxis(bounds.min, axis);
+        int firstCell = (int)((GetAxis(box.min, axis) - origin) / cellSize[axis]);
+        int lastCell = (int)((GetAxis(box.max, axis) - origin) / cellSize[axis]);
+        first[axis] = firstCell < 0 ? 0 : (firstCell >= (int)resolution[axis] ? resolution[axis] - 1 : firstCell);
+        last[axis] = lastCell < 0 ? 0 : (lastCell >= (int)resolution[axis] ? resolution[axis] - 1 : lastCell);
+    }
+}
+
+void GridAccelerator::Build(const std::vector<BoundingBox>& boxes)
+{
+    Clear();
+
+    uint32_t primitivesCount = 0;
+    for (auto& box : boxes) {
+        if (!box.IsEmpty()) {
+            bounds.Extend(box);
+            primitivesCount++;
+        }
+    }
+    if (primitivesCount == 0) {
+        return;
+    }
+
+    // Flat scenes still need a finite cell size along their flat axes.
+    Vector3 extent{ bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z };
+    float padding = Max(Max(extent.x, extent.y), Max(extent.z, 1.0f)) * 1e-4f;
+    bounds.min = Vector3{ bounds.min.x - padding, bounds.min.y - padding, bounds.min.z - padding };
+    bounds.max = Vector3{ bounds.max.x + padding, bounds.max.y + padding, bounds.max.z + padding };
+    extent = Vector3{ extent.x + 2 * padding, extent.y + 2 * padding, extent.z + 2 * padding };
+
+    float cellsPerUnit = cbrtf(CellsPerPrimitive * primitivesCount / (extent.x * extent.y * extent.z));
+    uint32_t cellsCount = 1;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float axisResolution = roundf(GetAxis(extent, axis) * cellsPerUnit);
+        resolution[axis] = axisResolution < 1 ? 1 : (axisResolution > MaxResolution ? MaxResolution : (uint32_t)axisResolution);
+        cellSize[axis] = GetAxis(extent, axis) / resolution[axis];
+        cellsCount *= resolution[axis];
+    }
+
+    uint32_t first[3], last[3];
+    cellOffsets.assign(cellsCount + 1, 0);
+    for (auto& box : boxes) {
+        if (box.IsEmpty()) {
+            continue;
+        }
+        GetCellRange(box, first, last);
+        for (uint32_t z = first[2]; z <= last[2]; z++) {
+            for (uint32_t y = first[1]; y <= last[1]; y++) {
+                for (uint32_t x = first[0]; x <= last[0]; x++) {
+                    cellOffsets[(z * resolution[1] + y) * resolution[0] + x + 1]++;
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < cellsCount; i++) {
+        cellOffsets[i + 1] += cellOffsets[i];
+    }
+
+    std::vector<uint32_t> cellEnds(cellOffsets.begin(), cellOffsets.end() - 1);
+    cellPrimitives.resize(cellOffsets.back());
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        if (boxes[i].IsEmpty()) {
+            continue;
+        }
+        GetCellRange(boxes[i], first, last);
+        for (uint32_t z = first[2]; z <= last[2]; z++) {
+            for (uint32_t y = first[1]; y <= last[1]; y++) {
+                for (uint32_t x = first[0]; x <= last[0]; x++) {
+                    cellPrimitives[cellEnds[(z * resolution[1] + y) * resolution[0] + x]++] = i;
+                }
+            }
+        }
+    }
+}
+
+bool GridAccelerator::Update(const std::vector<BoundingBox>& boxes)
+{
+    Build(boxes);
+    return true;
+}
+
+template<bool AnyHit>
+bool GridAccelerator::Traverse(const Ray& ray, float maxDistance, PrimitiveIntersector& intersector) const
+{
+    if (cellOffsets.empty()) {
+        return false;
+    }
+
+    float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+    float direction[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+    Vector3 inverseDirection{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+
+    float entryDistance;
+    if (!bounds.HasIntersection(ray.origin, inverseDirection, maxDistance, &entryDistance)) {
+        return false;
+    }
+
+    int cell[3], step[3], end[3];
+    float nextDistance[3], deltaDistance[3];
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float boundsMin = GetAxis(bounds.min, axis);
+        float position = origin[axis] + direction[axis] * entryDistance;
+        int index = (int)((position - boundsMin) / cellSize[axis]);
+        cell[axis] = index < 0 ? 0 : (index >= (int)resolution[axis] ? resolution[axis] - 1 : index);
+
+        if (direction[axis] > 0) {
+            step[axis] = 1;
+            end[axis] = resolution[axis];
+            nextDistance[axis] = (boundsMin + (cell[axis] + 1) * cellSize[axis] - origin[axis]) / direction[axis];
+            deltaDistance[axis] = cellSize[axis] / direction[axis];
+        }
+        else if (direction[axis] < 0) {
+            step[axis] = -1;
+            end[axis] = -1;
+            nextDistance[axis] = (boundsMin + cell[axis] * cellSize[axis] - origin[axis]) / direction[axis];
+            deltaDistance[axis] = -cellSize[axis] / direction[axis];
+        }
+        else {
+            step[axis] = 0;
+            end[axis] = -1;
+            nextDistance[axis] = INFINITY;
+            deltaDistance[axis] = INFINITY;
+        }
+    }
+
+    bool hasIntersection = false;
+    while (true) {
+        uint32_t cellIndex = (cell[2] * resolution[1] + cell[1]) * resolution[0] + cell[0];
+        for (uint32_t i = cellOffsets[cellIndex]; i < cellOffsets[cellIndex + 1]; i++) {
+            if (intersector(cellPrimitives[i], maxDistance)) {
+                if (AnyHit) {
+                    return true;
+                }
+                hasIntersection = true;
+            }
+        }
+
+        uint32_t axis = nextDistance[0] < nextDistance[1] ? (nextDistance[0] < nextDistance[2] ? 0 : 2) : (nextDistance[1] < nextDistance[2] ? 1 : 2);
+
+        // A hit inside the current cell cannot be beaten by primitives of the following cells.
+        if (maxDistance <= nextDistance[axis]) {
+            break;
+        }
+
+        cell[axis] += step[axis];
+        if (cell[axis] == end[axis]) {
+            break;
+        }
+        nextDistance[axis] += deltaDistance[axis];
+    }
+
+    return hasIntersection;
+}
+
+bool GridAccelerator::Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const
+{
+    return Traverse<false>(ray, maxDistance, intersector);
+}
+
+bool GridAccelerator::IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const
+{
+    return Traverse<true>(ray, maxDistance, intersector);
+}
+
+void GridAccelerator::Clear()
+{
+    bounds = BoundingBox();
+    cellOffsets.clear();
+    cellPrimitives.clear();
+}
@@ -0,0 +1,37 @@
+#ifndef GRID_ACCELERATOR_H
+#define GRID_ACCELERATOR_H
+
+#include "Accelerator.h"
+
+/*
+    Uniform grid traversed with a 3D DDA. The resolution follows the primitive density, every
+    cell stores the primitives overlapping it in one flat array indexed by cell offsets.
+*/
+class GridAccelerator : public Accelerator
+{
+private:
+    static const float CellsPerPrimitive;
+    static const uint32_t MaxResolution;
+
+    BoundingBox bounds;
+    uint32_t resolution[3];
+    float cellSize[3];
+    std::vector<uint32_t> cellOffsets;
+    std::vector<uint32_t> cellPrimitives;
+
+    void GetCellRange(const BoundingBox& box, uint32_t* first, uint32_t* last) const;
+
+    template<bool AnyHit>
+    bool Traverse(const Ray& ray, float maxDistance, PrimitiveIntersector& intersector) const;
+
+public:
+    GridAccelerator();
+
+    virtual void Build(const std::vector<BoundingBox>& boxes) override;
+    virtual bool Update(const std::vector<BoundingBox>& boxes) override;
+    virtual bool Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const override;
+    virtual bool IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const override;
+    virtual void Clear() override;
+};
+
+#endif
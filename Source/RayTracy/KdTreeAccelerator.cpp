@@ -0,0 +1,232 @@
+#include "KdTreeAccelerator.h"
+#include <math.h>
+#include <algorithm>
+
+const float KdTreeAccelerator::TraversalCost = 1;
+const float KdTreeAccelerator::IntersectionCost = 1.5f;
+const float KdTreeAccelerator::EmptyBonus = 0.5f;
+const uint32_t KdTreeAccelerator::LeafAxis = 3;
+
+inline void SetAxis(Vector3* vector, uint32_t axis, float value)
+{
+    if (axis == 0) {
+        vector->x = value;
+    }
+    else if (axis == 1) {
+        vector->y = value;
+    }
+    else {
+        vector->z = value;
+    }
+}
+
+void KdTreeAccelerator::Build(const std::vector<BoundingBox>& boxes)
+{
+    Clear();
+
+    std::vector<uint32_t> rootPrimitives;
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        if (!boxes[i].IsEmpty()) {
+            bounds.Extend(boxes[i]);
+            rootPrimitives.push_back(i);
+        }
+    }
+    if (rootPrimitives.empty()) {
+        return;
+    }
+
+    uint32_t maxDepth = (uint32_t)(8 + 1.3f * log2f((float)rootPrimitives.size()));
+    maxDepth = maxDepth > MaxStackSize - 1 ? MaxStackSize - 1 : maxDepth;
+
+    nodes.push_back(Node{});
+    BuildNode(0, bounds, rootPrimitives, boxes, maxDepth);
+}
+
+void KdTreeAccelerator::MakeLeaf(uint32_t node, const std::vector<uint32_t>& nodePrimitives)
+{
+    nodes[node].axis = LeafAxis;
+    nodes[node].offset = primitives.size();
+    nodes[node].count = nodePrimitives.size();
+    primitives.insert(primitives.end(), nodePrimitives.begin(), nodePrimitives.end());
+}
+
+void KdTreeAccelerator::BuildNode(uint32_t node, const BoundingBox& nodeBounds, std::vector<uint32_t>& nodePrimitives, const std::vector<BoundingBox>& boxes, uint32_t depth)
+{
+    uint32_t count = nodePrimitives.size();
+    float nodeArea = nodeBounds.GetSurfaceArea();
+    if (count <= 1 || depth == 0 || nodeArea <= 0) {
+        MakeLeaf(node, nodePrimitives);
+        return;
+    }
+
+    float bestCost = IntersectionCost * count;
+    uint32_t bestAxis = LeafAxis;
+    float bestSplit = 0;
+    std::vector<Edge> edges(count * 2);
+
+    for (uint32_t axis = 0; axis < 3; axis++) {
+        float axisMin = GetAxis(nodeBounds.min, axis), axisMax = GetAxis(nodeBounds.max, axis);
+        if (axisMax <= axisMin) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            auto& box = boxes[nodePrimitives[i]];
+            edges[i * 2] = Edge{ GetAxis(box.min, axis), nodePrimitives[i], true };
+            edges[i * 2 + 1] = Edge{ GetAxis(box.max, axis), nodePrimitives[i], false };
+        }
+        std::sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) {
+            return a.position < b.position || (a.position == b.position && a.start && !b.start);
+        });
+
+        uint32_t otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+        float extent0 = GetAxis(nodeBounds.max, otherAxis0) - GetAxis(nodeBounds.min, otherAxis0);
+        float extent1 = GetAxis(nodeBounds.max, otherAxis1) - GetAxis(nodeBounds.min, otherAxis1);
+        float capArea = 2 * extent0 * extent1, sideLength = 2 * (extent0 + extent1);
+
+        uint32_t belowCount = 0, aboveCount = count;
+        for (auto& edge : edges) {
+            if (!edge.start) {
+                aboveCount--;
+            }
+            if (edge.position > axisMin && edge.position < axisMax) {
+                float belowArea = capArea + sideLength * (edge.position - axisMin);
+                float aboveArea = capArea + sideLength * (axisMax - edge.position);
+                float bonus = belowCount == 0 || aboveCount == 0 ? EmptyBonus : 0;
+                float cost = TraversalCost + IntersectionCost * (1 - bonus) * (belowArea * belowCount + aboveArea * aboveCount) / nodeArea;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = edge.position;
+                }
+            }
+            if (edge.start) {
+                belowCount++;
+            }
+        }
+    }
+
+    if (bestAxis == LeafAxis) {
+        MakeLeaf(node, nodePrimitives);
+        return;
+    }
+
+    // Primitives touching the plane go to both sides, so a ray lying in the plane still finds them.
+    std::vector<uint32_t> below, above;
+    for (auto primitive : nodePrimitives) {
+        if (GetAxis(boxes[primitive].min, bestAxis) <= bestSplit) {
+            below.push_back(primitive);
+        }
+        if (GetAxis(boxes[primitive].max, bestAxis) >= bestSplit) {
+            above.push_back(primitive);
+        }
+    }
+    nodePrimitives.clear();
+    nodePrimitives.shrink_to_fit();
+
+    BoundingBox belowBounds = nodeBounds, aboveBounds = nodeBounds;
+    SetAxis(&belowBounds.max, bestAxis, bestSplit);
+    SetAxis(&aboveBounds.min, bestAxis, bestSplit);
+
+    uint32_t children = nodes.size();
+    nodes.push_back(Node{});
+    nodes.push_back(Node{});
+    nodes[node] = Node{ bestSplit, bestAxis, children, 0 };
+
+    BuildNode(children, belowBounds, below, boxes, depth - 1);
+    BuildNode(children + 1, aboveBounds, above, boxes, depth - 1);
+}
+
+bool KdTreeAccelerator::Update(const std::vector<BoundingBox>& boxes)
+{
+    Build(boxes);
+    return true;
+}
+
+template<bool AnyHit>
+bool KdTreeAccelerator::Traverse(const Ray& ray, float maxDistance, PrimitiveIntersector& intersector) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+
+    Vector3 inverseDirection{ 1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z };
+    float entryDistance, exitDistance;
+    if (!bounds.HasIntersection(ray.origin, inverseDirection, maxDistance, &entryDistance)) {
+        return false;
+    }
+    float x1 = (bounds.min.x - ray.origin.x) * inverseDirection.x, x2 = (bounds.max.x - ray.origin.x) * inverseDirection.x;
+    float y1 = (bounds.min.y - ray.origin.y) * inverseDirection.y, y2 = (bounds.max.y - ray.origin.y) * inverseDirection.y;
+    float z1 = (bounds.min.z - ray.origin.z) * inverseDirection.z, z2 = (bounds.max.z - ray.origin.z) * inverseDirection.z;
+    exitDistance = Min(Min(Max(x1, x2), Max(y1, y2)), Min(Max(z1, z2), maxDistance));
+
+    StackEntry stack[MaxStackSize];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+    bool hasIntersection = false;
+
+    while (true) {
+        // Everything left on this path starts behind the closest hit found so far.
+        if (maxDistance < entryDistance) {
+            break;
+        }
+
+        const Node& node = nodes[nodeIndex];
+        if (node.axis != LeafAxis) {
+            float origin = GetAxis(ray.origin, node.axis), direction = GetAxis(ray.direction, node.axis);
+            bool belowFirst = origin < node.split || (origin == node.split && direction <= 0);
+            uint32_t first = belowFirst ? node.offset : node.offset + 1;
+            uint32_t second = belowFirst ? node.offset + 1 : node.offset;
+            float planeDistance = direction != 0 ? (node.split - origin) * GetAxis(inverseDirection, node.axis) : INFINITY;
+
+            if (planeDistance > exitDistance || planeDistance <= 0) {
+                nodeIndex = first;
+            }
+            else if (planeDistance < entryDistance) {
+                nodeIndex = second;
+            }
+            else {
+                stack[stackSize++] = StackEntry{ second, planeDistance, exitDistance };
+                nodeIndex = first;
+                exitDistance = planeDistance;
+            }
+            continue;
+        }
+
+        for (uint32_t i = 0; i < node.count; i++) {
+            if (intersector(primitives[node.offset + i], maxDistance)) {
+                if (AnyHit) {
+                    return true;
+                }
+                hasIntersection = true;
+            }
+        }
+
+        if (stackSize == 0) {
+            break;
+        }
+        auto entry = stack[--stackSize];
+        nodeIndex = entry.node;
+        entryDistance = entry.entryDistance;
+        exitDistance = entry.exitDistance;
+    }
+
+    return hasIntersection;
+}
+
+bool KdTreeAccelerator::Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const
+{
+    return Traverse<false>(ray, maxDistance, intersector);
+}
+
+bool KdTreeAccelerator::IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const
+{
+    return Traverse<true>(ray, maxDistance, intersector);
+}
+
+void KdTreeAccelerator::Clear()
+{
+    bounds = BoundingBox();
+    nodes.clear();
+    primitives.clear();
+}
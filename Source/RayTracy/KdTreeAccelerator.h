@@ -0,0 +1,60 @@
+#ifndef KD_TREE_ACCELERATOR_H
+#define KD_TREE_ACCELERATOR_H
+
+#include "Accelerator.h"
+
+/*
+    SAH kd-tree. Split planes are chosen by sweeping the sorted box edges of every axis,
+    primitives overlapping a plane are referenced from both sides.
+*/
+class KdTreeAccelerator : public Accelerator
+{
+private:
+    static const float TraversalCost;
+    static const float IntersectionCost;
+    static const float EmptyBonus;
+    static const uint32_t LeafAxis;
+
+    struct Node
+    {
+        float split;
+        uint32_t axis;
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    struct Edge
+    {
+        float position;
+        uint32_t primitive;
+        bool start;
+    };
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float entryDistance;
+        float exitDistance;
+    };
+
+    static const uint32_t MaxStackSize = 64;
+
+    BoundingBox bounds;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> primitives;
+
+    void BuildNode(uint32_t node, const BoundingBox& nodeBounds, std::vector<uint32_t>& nodePrimitives, const std::vector<BoundingBox>& boxes, uint32_t depth);
+    void MakeLeaf(uint32_t node, const std::vector<uint32_t>& nodePrimitives);
+
+    template<bool AnyHit>
+    bool Traverse(const Ray& ray, float maxDistance, PrimitiveIntersector& intersector) const;
+
+public:
+    virtual void Build(const std::vector<BoundingBox>& boxes) override;
+    virtual bool Update(const std::vector<BoundingBox>& boxes) override;
+    virtual bool Intersect(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const override;
+    virtual bool IsOccluded(const Ray& ray, float maxDistance, PrimitiveIntersector intersector) const override;
+    virtual void Clear() override;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "LocalSocket.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+bool GetLocalAddress(const std::string& path, sockaddr_un* address)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address->sun_path)) {
+        return false;
+    }
+    strcpy(address->sun_path, path.c_str());
+    return true;
+}
+
+int ListenLocal(const std::string& path, int backlog)
+{
+    sockaddr_un address;
+    if (!GetLocalAddress(path, &address)) {
+        return -1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener >= 0 && (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, backlog) != 0)) {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+int ConnectLocal(const std::string& path)
+{
+    sockaddr_un address;
+    if (!GetLocalAddress(path, &address)) {
+        return -1;
+    }
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection >= 0 && connect(connection, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(connection);
+        return -1;
+    }
+    return connection;
+}
+
+bool SendAll(int connection, const void* data, size_t size)
+{
+    auto bytes = (const uint8_t*)data;
+    while (size > 0) {
+        auto sent = send(connection, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool ReceiveAll(int connection, void* data, size_t size)
+{
+    auto bytes = (uint8_t*)data;
+    while (size > 0) {
+        auto received = recv(connection, bytes, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool SetTimeout(int connection, int milliseconds)
+{
+    timeval timeout = { milliseconds / 1000, (milliseconds % 1000) * 1000 };
+    return setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+        setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+int GetPeerProcess(int connection)
+{
+    ucred credentials;
+    socklen_t size = sizeof(credentials);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0) {
+        return -1;
+    }
+    return credentials.pid;
+}
@@ -0,0 +1,27 @@
+#ifndef LOCAL_SOCKET_H
+#define LOCAL_SOCKET_H
+
+#include <stddef.h>
+#include <string>
+
+/*
+    Unix domain stream sockets for the render farm and the render server. The functions return
+    -1 or false on failure, messages are printed by the callers.
+*/
+int ListenLocal(const std::string& path, int backlog);
+int ConnectLocal(const std::string& path);
+/*
+    Send and receive the whole buffer or fail, a closed connection fails without raising SIGPIPE.
+*/
+bool SendAll(int connection, const void* data, size_t size);
+bool ReceiveAll(int connection, void* data, size_t size);
+/*
+    Makes sends and receives that wait longer than the timeout fail.
+*/
+bool SetTimeout(int connection, int milliseconds);
+/*
+    Returns the process id of the other end of the connection.
+*/
+int GetPeerProcess(int connection);
+
+#endif
@@ -109,4 +109,24 @@ Vector3 Matrix4::operator*(Vector3 v) const
         Get(1, 0) * v.x + Get(1, 1) * v.y + Get(1, 2) * v.z + Get(1, 3),
         Get(2, 0) * v.x + Get(2, 1) * v.y + Get(2, 2) * v.z + Get(2, 3)
     };
-}
\ No newline at end of file
+}
+
+Vector3 Matrix4::TransformDirection(Vector3 v) const
+{
+    return Vector3
+    {
+        Get(0, 0) * v.x + Get(0, 1) * v.y + Get(0, 2) * v.z,
+        Get(1, 0) * v.x + Get(1, 1) * v.y + Get(1, 2) * v.z,
+        Get(2, 0) * v.x + Get(2, 1) * v.y + Get(2, 2) * v.z
+    };
+}
+
+Vector3 Matrix4::TransformNormal(Vector3 v) const
+{
+    return Vector3
+    {
+        Get(0, 0) * v.x + Get(1, 0) * v.y + Get(2, 0) * v.z,
+        Get(0, 1) * v.x + Get(1, 1) * v.y + Get(2, 1) * v.z,
+        Get(0, 2) * v.x + Get(1, 2) * v.y + Get(2, 2) * v.z
+    };
+}
@@ -4,6 +4,7 @@
 #include "Vector.h"
 #include <stdint.h>
 #include <memory>
+#include <initializer_list>
 
 class Matrix4
 {
@@ -32,6 +33,14 @@ public:
     }
 
     Vector3 operator*(Vector3 v) const;
+
+    /*
+        Directions ignore the translation. Normals are multiplied by the transposed upper 3x3 part,
+        so a world-to-object matrix carries object-space normals to world space.
+    */
+    Vector3 TransformDirection(Vector3 v) const;
+    Vector3 TransformNormal(Vector3 v) const;
+
     Matrix4 operator*(const Matrix4& other) const;
 };
 
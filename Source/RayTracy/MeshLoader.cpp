@@ -1,6 +1,7 @@
 #include "MeshLoader.h"
 #include <stdio.h>
 #include <vector>
+#include <unordered_map>
 #include <string.h>
 #include <cstdlib>
 
@@ -8,9 +9,31 @@ const uint32_t MeshLoader::LineLength = 200;
 const uint32_t MeshLoader::TokenLength = 200;
 const char* MeshLoader::Delimiters = " /";
 
-bool MeshLoader::ParseFloat(float& value)
+bool MeshLoader::CachedVertex::operator==(const CachedVertex& other) const
 {
-    auto token = strtok(0, Delimiters);
+    return vertex.x == other.vertex.x && vertex.y == other.vertex.y && vertex.z == other.vertex.z &&
+        textureCoordinate.x == other.textureCoordinate.x && textureCoordinate.y == other.textureCoordinate.y;
+}
+
+size_t MeshLoader::CachedVertexHash::operator()(const CachedVertex& cachedVertex) const
+{
+    // Equal values hash equally, so negative zero is hashed as zero.
+    float values[] = { cachedVertex.vertex.x, cachedVertex.vertex.y, cachedVertex.vertex.z,
+        cachedVertex.textureCoordinate.x, cachedVertex.textureCoordinate.y };
+    uint64_t hash = 14695981039346656037ull;
+    for (float value : values) {
+        uint32_t bits = 0;
+        if (value != 0.0f) {
+            memcpy(&bits, &value, sizeof(bits));
+        }
+        hash = (hash ^ bits) * 1099511628211ull;
+    }
+    return (size_t)hash;
+}
+
+bool MeshLoader::ParseFloat(Tokenizer& tokenizer, float& value) const
+{
+    auto token = tokenizer.Next();
     if (!token) {
         return false;
     }
@@ -18,9 +41,9 @@ bool MeshLoader::ParseFloat(float& value)
     return true;
 }
 
-bool MeshLoader::ParseInt(int& value)
+bool MeshLoader::ParseInt(Tokenizer& tokenizer, int& value) const
 {
-    auto token = strtok(0, Delimiters);
+    auto token = tokenizer.Next();
     if (!token) {
         return false;
     }
@@ -28,21 +51,27 @@ bool MeshLoader::ParseInt(int& value)
     return true;
 }
 
-bool MeshLoader::LoadMesh(const std::string& directoryPath, const std::string& path, Mesh* mesh)
+bool MeshLoader::LoadMesh(const std::string& directoryPath, const std::string& path, MeshData* mesh, std::string* fullPath)
 {
-    FILE* file = fopen(path.c_str(), "r");
+    auto openedPath = path;
+    FILE* file = fopen(openedPath.c_str(), "r");
     if (!file) {
-        auto fullPath = directoryPath + "/" + path;
-        file = fopen(fullPath.c_str(), "r");
+        openedPath = directoryPath + "/" + path;
+        file = fopen(openedPath.c_str(), "r");
         if (!file) {
             return false;
         }
     }
+    if (fullPath) {
+        *fullPath = openedPath;
+    }
 
     char line[LineLength];
+    Tokenizer tokenizer(Delimiters);
     std::vector<Vector3> vertices, cachedVertices;
     std::vector<Vector2> textureCoordinates, cachedTextureCoordinates;
     std::vector<int> faces, indices;
+    std::unordered_map<CachedVertex, uint32_t, CachedVertexHash> cachedIndices;
 
     while (!feof(file)) {
         line[0] = 0;
@@ -50,17 +79,20 @@ bool MeshLoader::LoadMesh(const std::string& directoryPath, const std::string& p
         if (line[0] == 0) {
             break;
         }
-        auto name = strtok(line, Delimiters);
+        auto name = tokenizer.First(line);
+        if (!name) {
+            continue;
+        }
         if (strcmp(name, "v") == 0) {
             Vector3 vertex;
-            if (!ParseFloat(vertex.x) || !ParseFloat(vertex.y) || !ParseFloat(vertex.z)) {
+            if (!ParseFloat(tokenizer, vertex.x) || !ParseFloat(tokenizer, vertex.y) || !ParseFloat(tokenizer, vertex.z)) {
                 return false;
             }
             vertices.push_back(vertex);
         }
         else if (strcmp(name, "vt") == 0) {
             Vector2 textureCoordinate;
-            if (!ParseFloat(textureCoordinate.x) || !ParseFloat(textureCoordinate.y)) {
+            if (!ParseFloat(tokenizer, textureCoordinate.x) || !ParseFloat(tokenizer, textureCoordinate.y)) {
                 return false;
             }
             textureCoordinates.push_back(textureCoordinate);
@@ -68,7 +100,7 @@ bool MeshLoader::LoadMesh(const std::string& directoryPath, const std::string& p
         else if (strcmp(name, "f") == 0) {
             int index;
             for (uint32_t i = 0; i < 6; i++) {
-                if (!ParseInt(index) || index <= 0) {
+                if (!ParseInt(tokenizer, index) || index <= 0) {
                     return false;
                 }
                 faces.push_back(index);
@@ -88,19 +120,16 @@ bool MeshLoader::LoadMesh(const std::string& directoryPath, const std::string& p
             auto vertex = vertices[vertexIndex];
             auto textureCoordinate = textureCoordinates[textureCoordinateIndex];
 
-            uint32_t cachedIndex = cachedVertices.size();
+            CachedVertex key = { vertex, textureCoordinate };
+            auto cached = cachedIndices.find(key);
+            uint32_t cachedIndex;
 
-            for (uint32_t k = 0; k < cachedVertices.size(); k++) {
-                auto cachedVertex = cachedVertices[k];
-                auto cachedTextureCoordinate = cachedTextureCoordinates[k];
-
-                if (cachedVertex == vertex && cachedTextureCoordinate == textureCoordinate) {
-                    cachedIndex = k;
-                    break;
-                }
+            if (cached != cachedIndices.end()) {
+                cachedIndex = cached->second;
             }
-
-            if (cachedIndex == cachedVertices.size()) {
+            else {
+                cachedIndex = cachedVertices.size();
+                cachedIndices[key] = cachedIndex;
                 cachedVertices.push_back(vertex);
                 cachedTextureCoordinates.push_back(textureCoordinate);
             }
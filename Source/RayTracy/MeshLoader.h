@@ -2,6 +2,7 @@
 #define MESH_LOADER_H
 
 #include "Geometry.h"
+#include "Tokenizer.h"
 #include <string>
 
 class MeshLoader
@@ -11,11 +12,30 @@ private:
     static const uint32_t TokenLength;
     static const char* Delimiters;
 
-    bool ParseFloat(float& value);
-    bool ParseInt(int& value);
+    /*
+        Vertices are merged when both their position and their texture coordinate are equal.
+    */
+    struct CachedVertex
+    {
+        Vector3 vertex;
+        Vector2 textureCoordinate;
+
+        bool operator==(const CachedVertex& other) const;
+    };
+
+    struct CachedVertexHash
+    {
+        size_t operator()(const CachedVertex& cachedVertex) const;
+    };
+
+    bool ParseFloat(Tokenizer& tokenizer, float& value) const;
+    bool ParseInt(Tokenizer& tokenizer, int& value) const;
 
 public:
-    bool LoadMesh(const std::string& directoryPath, const std::string& path, Mesh* mesh);
+    /*
+        Safe to call from several threads at once.
+    */
+    bool LoadMesh(const std::string& directoryPath, const std::string& path, MeshData* mesh, std::string* fullPath = nullptr);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "PerformanceCounters.h"
+
+#ifdef PLATFORM_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+
+PerformanceCounters::PerformanceCounters()
+{
+    for (uint32_t i = 0; i < EventsCount; i++) {
+        descriptors[i] = Unopened;
+        values[i] = 0;
+    }
+}
+
+PerformanceCounters::~PerformanceCounters()
+{
+    for (uint32_t i = 0; i < EventsCount; i++) {
+        if (descriptors[i] >= 0) {
+            close(descriptors[i]);
+        }
+    }
+}
+
+bool PerformanceCounters::Start()
+{
+    bool available = false;
+    for (uint32_t i = 0; i < EventsCount; i++) {
+        if (descriptors[i] == Unopened) {
+            perf_event_attr attributes;
+            memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.disabled = 1;
+            attributes.inherit = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            if ((PerformanceEvent)i == PerformanceEvent::L1DataMisses) {
+                attributes.type = PERF_TYPE_HW_CACHE;
+                attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            }
+            else {
+                attributes.type = PERF_TYPE_HARDWARE;
+                attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+            }
+            descriptors[i] = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+        }
+
+        values[i] = 0;
+        if (descriptors[i] >= 0) {
+            ioctl(descriptors[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(descriptors[i], PERF_EVENT_IOC_ENABLE, 0);
+            available = true;
+        }
+    }
+    return available;
+}
+
+void PerformanceCounters::Stop()
+{
+    for (uint32_t i = 0; i < EventsCount; i++) {
+        if (descriptors[i] < 0) {
+            continue;
+        }
+        ioctl(descriptors[i], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value;
+        values[i] = read(descriptors[i], &value, sizeof(value)) == sizeof(value) ? value : 0;
+    }
+}
+
+bool PerformanceCounters::IsAvailable(PerformanceEvent event) const
+{
+    return descriptors[(uint32_t)event] >= 0;
+}
+#else
+PerformanceCounters::PerformanceCounters()
+{
+    for (uint32_t i = 0; i < EventsCount; i++) {
+        descriptors[i] = -1;
+        values[i] = 0;
+    }
+}
+
+PerformanceCounters::~PerformanceCounters()
+{
+}
+
+bool PerformanceCounters::Start()
+{
+    return false;
+}
+
+void PerformanceCounters::Stop()
+{
+}
+
+bool PerformanceCounters::IsAvailable(PerformanceEvent) const
+{
+    return false;
+}
+#endif
+
+uint64_t PerformanceCounters::GetValue(PerformanceEvent event) const
+{
+    return values[(uint32_t)event];
+}
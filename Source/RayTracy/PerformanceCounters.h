@@ -0,0 +1,45 @@
+#ifndef PERFORMANCE_COUNTERS_H
+#define PERFORMANCE_COUNTERS_H
+
+#include <stdint.h>
+
+enum class PerformanceEvent
+{
+    L1DataMisses,
+    LastLevelMisses,
+    Count
+};
+
+/*
+    Hardware cache miss counters of the calling thread and the threads it starts afterwards,
+    opened through perf_event_open on Linux. Events the CPU, a virtual machine or
+    perf_event_paranoid do not allow are reported as unavailable instead of failing.
+*/
+class PerformanceCounters
+{
+private:
+    static const uint32_t EventsCount = (uint32_t)PerformanceEvent::Count;
+    static const int Unopened = -2;
+
+    int descriptors[EventsCount];
+    uint64_t values[EventsCount];
+
+public:
+    PerformanceCounters();
+    ~PerformanceCounters();
+
+    /*
+        Opens the counters on first use, then resets and enables them. Returns false when no
+        event is available.
+    */
+    bool Start();
+    void Stop();
+
+    bool IsAvailable(PerformanceEvent event) const;
+    uint64_t GetValue(PerformanceEvent event) const;
+
+    PerformanceCounters(const PerformanceCounters& other) = delete;
+    PerformanceCounters& operator=(const PerformanceCounters& other) = delete;
+};
+
+#endif
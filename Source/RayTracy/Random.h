@@ -0,0 +1,41 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+/*
+    Counter based random numbers. The sequence is a hash of its key and a counter, so every
+    sample of every pixel can be drawn on its own, in any order and on any thread, and always
+    gets the same values.
+*/
+class CounterRandom
+{
+private:
+    uint32_t key;
+    uint32_t counter;
+
+    // PCG output permutation, a good 32 bit integer hash.
+    static inline uint32_t Hash(uint32_t value)
+    {
+        uint32_t state = value * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+public:
+    inline CounterRandom(uint32_t x, uint32_t y, uint32_t sample, uint32_t frame) :
+        key(Hash(x + Hash(y + Hash(sample + Hash(frame))))),
+        counter(0)
+    {
+    }
+
+    /*
+        Uniform in [0, 1).
+    */
+    inline float Next()
+    {
+        return (Hash(key + 0x9E3779B9u * counter++) >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+#endif
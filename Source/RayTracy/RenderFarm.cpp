@@ -0,0 +1,295 @@
+#include "RenderFarm.h"
+#include "TextureLoader.h"
+#include "LocalSocket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+const int RenderFarm::PollInterval = 50;
+const int RenderFarm::BandTimeout = 120000;
+
+RenderFarm::RenderFarm() :
+    workersCount(0),
+    width(640),
+    height(480),
+    bandsCount(0),
+    finishedBands(0),
+    isStopping(false)
+{
+}
+
+bool RenderFarm::ParseArguments(int argc, char** argv, std::vector<char*>* arguments)
+{
+    arguments->assign(argv, argv + 1);
+    bool isAdaptive = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--farm") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &workersCount) != 1 || workersCount == 0) {
+                printf("Cannot parse workers count '%s'.\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+            outputPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--farm-worker") == 0 && hasValue) {
+            socketPath = argv[++i];
+        }
+        else {
+            // The frame size and the sampling are renderer options, they are only looked at here.
+            if (strcmp(argv[i], "--size") == 0 && hasValue && (sscanf(argv[i + 1], "%ux%u", &width, &height) != 2 || width == 0 || height == 0)) {
+                printf("Cannot parse size '%s'.\n", argv[i + 1]);
+                return false;
+            }
+            isAdaptive = isAdaptive || strcmp(argv[i], "--adaptive") == 0;
+            arguments->push_back(argv[i]);
+        }
+    }
+
+    if (IsCoordinator() && IsWorker()) {
+        printf("A farm worker cannot start a farm.\n");
+        return false;
+    }
+    if (IsCoordinator() && outputPath.empty()) {
+        printf("Specify the output image path with --output.\n");
+        return false;
+    }
+    if (!IsCoordinator() && !outputPath.empty()) {
+        printf("Output path is only available with --farm.\n");
+        return false;
+    }
+    if (IsCoordinator() && isAdaptive) {
+        printf("Adaptive sampling is not available with --farm.\n");
+        return false;
+    }
+    return true;
+}
+
+bool RenderFarm::IsCoordinator() const
+{
+    return workersCount > 0;
+}
+
+bool RenderFarm::IsWorker() const
+{
+    return !socketPath.empty();
+}
+
+bool RenderFarm::Coordinate(const std::vector<char*>& arguments)
+{
+    // mkdtemp creates the directory with mode 0700, so other users cannot reach the socket.
+    char directory[] = "/tmp/raytracy-farm-XXXXXX";
+    if (!mkdtemp(directory)) {
+        printf("Cannot create a directory for the farm socket.\n");
+        return false;
+    }
+    socketPath = std::string(directory) + "/farm.sock";
+
+    int listener = ListenLocal(socketPath, workersCount);
+    if (listener < 0) {
+        printf("Cannot listen on '%s'.\n", socketPath.c_str());
+        rmdir(directory);
+        return false;
+    }
+
+    bandsCount = (height + Renderer::TileSize - 1) / Renderer::TileSize;
+    for (uint32_t i = 0; i < bandsCount; i++) {
+        bands.push_back(i);
+    }
+    std::vector<uint8_t> frame(4 * width * height);
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<int> processes;
+    std::vector<std::thread> connections;
+    if (StartWorkers(arguments, &processes)) {
+        AcceptWorkers(listener, processes, connections, frame.data());
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+    rmdir(directory);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isStopping = true;
+    }
+    condition.notify_all();
+    for (auto& connection : connections) {
+        connection.join();
+    }
+    // Workers that are still loading the scene exit when they cannot connect.
+    for (auto process : processes) {
+        if (process > 0) {
+            waitpid(process, nullptr, 0);
+        }
+    }
+
+    if (finishedBands < bandsCount) {
+        printf("All workers exited before the frame was finished, %d of %d bands are rendered.\n", finishedBands, bandsCount);
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    printf("Rendered %dx%d on %d workers in %.3f s.\n", width, height, workersCount, seconds);
+
+    TextureLoader imageWriter;
+    if (!imageWriter.SaveImage(outputPath, frame.data(), width, height)) {
+        printf("Cannot write image '%s'.\n", outputPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> RenderFarm::GetWorkerArguments(const std::vector<char*>& arguments) const
+{
+    std::vector<std::string> workerArguments(arguments.begin(), arguments.end());
+    workerArguments.push_back("--farm-worker");
+    workerArguments.push_back(socketPath);
+
+    // Workers share the machine, unless told otherwise each gets an equal part of its threads.
+    bool hasThreads = std::find(workerArguments.begin(), workerArguments.end(), "--threads") != workerArguments.end();
+    if (!hasThreads) {
+        uint32_t threadsCount = std::max(1u, std::thread::hardware_concurrency() / workersCount);
+        workerArguments.push_back("--threads");
+        workerArguments.push_back(std::to_string(threadsCount));
+    }
+    return workerArguments;
+}
+
+bool RenderFarm::StartWorkers(const std::vector<char*>& arguments, std::vector<int>* processes)
+{
+    auto workerArguments = GetWorkerArguments(arguments);
+    std::vector<char*> argv;
+    for (auto& argument : workerArguments) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    // No other thread runs yet, the children only exec.
+    fflush(stdout);
+    for (uint32_t i = 0; i < workersCount; i++) {
+        int process = fork();
+        if (process == 0) {
+            execv("/proc/self/exe", argv.data());
+            _exit(127);
+        }
+        if (process < 0) {
+            printf("Cannot start worker %d.\n", i);
+            continue;
+        }
+        processes->push_back(process);
+    }
+    return !processes->empty();
+}
+
+void RenderFarm::AcceptWorkers(int listener, std::vector<int>& processes, std::vector<std::thread>& connections, uint8_t* frame)
+{
+    uint32_t runningWorkers = processes.size();
+    while (runningWorkers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (finishedBands == bandsCount) {
+                return;
+            }
+        }
+
+        // A band of an exited worker is queued again by its connection thread.
+        for (auto& process : processes) {
+            if (process > 0 && waitpid(process, nullptr, WNOHANG) == process) {
+                process = 0;
+                runningWorkers--;
+            }
+        }
+
+        pollfd descriptor = { listener, POLLIN, 0 };
+        if (poll(&descriptor, 1, PollInterval) > 0) {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0) {
+                continue;
+            }
+            // Other processes of this user can still connect, they are not given any bands.
+            int process = GetPeerProcess(connection);
+            if (process <= 0 || std::find(processes.begin(), processes.end(), process) == processes.end()) {
+                printf("Refused a connection from process %d, it is not a worker.\n", process);
+                close(connection);
+                continue;
+            }
+            SetTimeout(connection, BandTimeout);
+            connections.push_back(std::thread(&RenderFarm::ServeWorker, this, connection, process, frame));
+        }
+    }
+}
+
+void RenderFarm::ServeWorker(int connection, int process, uint8_t* frame)
+{
+    while (true) {
+        uint32_t band;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return isStopping || !bands.empty() || finishedBands == bandsCount; });
+            if (isStopping || bands.empty()) {
+                break;
+            }
+            band = bands.front();
+            bands.pop_front();
+        }
+
+        // Bands do not overlap, so the rows are received straight into the frame.
+        BandRequest request = { width, height, band * Renderer::TileSize, std::min((band + 1) * Renderer::TileSize, height) };
+        BandHeader header;
+        errno = 0;
+        bool isReceived = SendAll(connection, &request, sizeof(request)) && ReceiveAll(connection, &header, sizeof(header)) &&
+            header.beginY == request.beginY && header.endY == request.endY &&
+            ReceiveAll(connection, frame + 4 * width * request.beginY, 4 * width * (request.endY - request.beginY));
+        // A hung worker would otherwise keep running after the frame, it is killed so that it can be waited for.
+        if (!isReceived && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            printf("Worker %d did not answer in %d s, its band is rendered again.\n", process, BandTimeout / 1000);
+            kill(process, SIGKILL);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!isReceived) {
+            bands.push_front(band);
+            condition.notify_all();
+            break;
+        }
+        if (++finishedBands == bandsCount) {
+            condition.notify_all();
+        }
+    }
+    close(connection);
+}
+
+bool RenderFarm::Work(Renderer* renderer)
+{
+    int connection = ConnectLocal(socketPath);
+    if (connection < 0) {
+        printf("Cannot connect to '%s'.\n", socketPath.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> buffer;
+    BandRequest request;
+    bool isWorking = true;
+    while (ReceiveAll(connection, &request, sizeof(request))) {
+        buffer.resize(4 * (size_t)request.width * (request.endY - request.beginY));
+        if (!renderer->RenderRows(buffer.data(), request.width, request.height, request.beginY, request.endY)) {
+            printf("Cannot render rows %d to %d of %dx%d.\n", request.beginY, request.endY, request.width, request.height);
+            isWorking = false;
+            break;
+        }
+        BandHeader header = { request.beginY, request.endY };
+        if (!SendAll(connection, &header, sizeof(header)) || !SendAll(connection, buffer.data(), buffer.size())) {
+            break;
+        }
+    }
+    close(connection);
+    return isWorking;
+}
@@ -0,0 +1,81 @@
+#ifndef RENDER_FARM_H
+#define RENDER_FARM_H
+
+#include "Renderer.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/*
+    Renders one frame on several worker processes. The coordinator starts the workers as copies
+    of this executable with --farm-worker, each loads the scene and connects back over a Unix
+    domain socket. Bands of one tile row are handed to whichever worker is idle and the rendered
+    rows are copied into the frame. The band of a worker that exits or drops its connection goes
+    back to the queue for the remaining workers, a worker that sends nothing for BandTimeout is
+    killed and its band goes back too. The socket is in a directory only this user can enter and
+    connections from processes other than the started workers are refused.
+
+    The workers render with the same sample positions as a single process, so the frame does not
+    depend on the workers count.
+*/
+class RenderFarm
+{
+public:
+    RenderFarm();
+
+    /*
+        Takes the farm options out of the command line and returns the remaining arguments for
+        the renderer of a worker, or of a normal run.
+    */
+    bool ParseArguments(int argc, char** argv, std::vector<char*>* arguments);
+    bool IsCoordinator() const;
+    bool IsWorker() const;
+
+    /*
+        Starts the workers with the renderer arguments, gathers the frame and writes it to the output path.
+    */
+    bool Coordinate(const std::vector<char*>& arguments);
+    /*
+        Renders the bands the coordinator asks for until it closes the connection.
+    */
+    bool Work(Renderer* renderer);
+
+    RenderFarm(const RenderFarm& other) = delete;
+    RenderFarm& operator=(const RenderFarm& other) = delete;
+
+private:
+    static const int PollInterval;
+    static const int BandTimeout;
+
+    struct BandRequest
+    {
+        uint32_t width, height;
+        uint32_t beginY, endY;
+    };
+
+    struct BandHeader
+    {
+        uint32_t beginY, endY;
+    };
+
+    uint32_t workersCount;
+    uint32_t width, height;
+    std::string outputPath, socketPath;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<uint32_t> bands;
+    uint32_t bandsCount, finishedBands;
+    bool isStopping;
+
+    std::vector<std::string> GetWorkerArguments(const std::vector<char*>& arguments) const;
+    bool StartWorkers(const std::vector<char*>& arguments, std::vector<int>* processes);
+    void ServeWorker(int connection, int process, uint8_t* frame);
+    void AcceptWorkers(int listener, std::vector<int>& processes, std::vector<std::thread>& connections, uint8_t* frame);
+};
+
+#endif
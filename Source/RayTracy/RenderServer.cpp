@@ -0,0 +1,325 @@
+#include "RenderServer.h"
+#include "TextureLoader.h"
+#include "LocalSocket.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <chrono>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+const uint32_t RenderServer::MaxFrameSize = 16384;
+const uint32_t RenderServer::MaxSamplesCount = 16;
+const uint32_t RenderServer::MaxPathLength = 4096;
+const int RenderServer::PollInterval = 100;
+const int RenderServer::ConnectionTimeout = 30000;
+
+volatile sig_atomic_t isStopRequested = 0;
+
+void RequestStop(int)
+{
+    isStopRequested = 1;
+}
+
+RenderServer::RenderServer() :
+    isServer(false),
+    isClient(false),
+    cacheSize(4),
+    width(640),
+    height(480),
+    samplesCount(2),
+    frameIndex(0)
+{
+}
+
+bool RenderServer::ParseArguments(int argc, char** argv, std::vector<char*>* arguments)
+{
+    arguments->assign(argv, argv + 1);
+    bool hasCacheSize = false;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--serve") == 0 && hasValue) {
+            isServer = true;
+            socketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connect") == 0 && hasValue) {
+            isClient = true;
+            socketPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &cacheSize) != 1 || cacheSize == 0) {
+                printf("Cannot parse cache size '%s'.\n", argv[i]);
+                return false;
+            }
+            hasCacheSize = true;
+        }
+        else {
+            arguments->push_back(argv[i]);
+        }
+    }
+
+    if (isServer && isClient) {
+        printf("Use either --serve or --connect.\n");
+        return false;
+    }
+    if (hasCacheSize && !isServer) {
+        printf("Cache size is only available with --serve.\n");
+        return false;
+    }
+    return !isClient || ParseRequestArguments(*arguments);
+}
+
+bool RenderServer::ParseRequestArguments(const std::vector<char*>& arguments)
+{
+    for (size_t i = 1; i < arguments.size(); i++) {
+        bool hasValue = i + 1 < arguments.size();
+        if (strcmp(arguments[i], "--size") == 0 && hasValue) {
+            if (sscanf(arguments[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+                printf("Cannot parse size '%s'.\n", arguments[i]);
+                return false;
+            }
+        }
+        else if (strcmp(arguments[i], "--samples") == 0 && hasValue) {
+            if (sscanf(arguments[++i], "%u", &samplesCount) != 1 || samplesCount == 0) {
+                printf("Cannot parse samples count '%s'.\n", arguments[i]);
+                return false;
+            }
+        }
+        else if (strcmp(arguments[i], "--frame") == 0 && hasValue) {
+            if (sscanf(arguments[++i], "%u", &frameIndex) != 1) {
+                printf("Cannot parse frame index '%s'.\n", arguments[i]);
+                return false;
+            }
+        }
+        else if (strcmp(arguments[i], "--output") == 0 && hasValue) {
+            outputPath = arguments[++i];
+        }
+        else if (scenePath.empty() && arguments[i][0] != '-') {
+            scenePath = arguments[i];
+        }
+        else {
+            printf("Unknown argument '%s'.\n", arguments[i]);
+            return false;
+        }
+    }
+
+    if (scenePath.empty() || outputPath.empty()) {
+        printf("Specify scene file path and output image path.\n");
+        printf("Usage: RayTracy --connect <socket> <scene> [--size <width>x<height>] [--samples <count>] [--frame <index>] --output <image.png>\n");
+        return false;
+    }
+    return true;
+}
+
+bool RenderServer::IsServer() const
+{
+    return isServer;
+}
+
+bool RenderServer::IsClient() const
+{
+    return isClient;
+}
+
+int RenderServer::Listen()
+{
+    // A socket file left by a server that did not stop cleanly is replaced, a running server is not.
+    struct stat status;
+    if (stat(socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        int connection = ConnectLocal(socketPath);
+        if (connection >= 0) {
+            close(connection);
+            printf("A server is already listening on '%s'.\n", socketPath.c_str());
+            return -1;
+        }
+        unlink(socketPath.c_str());
+    }
+
+    int listener = ListenLocal(socketPath, SOMAXCONN);
+    if (listener < 0) {
+        printf("Cannot listen on '%s'.\n", socketPath.c_str());
+    }
+    return listener;
+}
+
+bool RenderServer::Serve(Renderer* renderer)
+{
+    int listener = Listen();
+    if (listener < 0) {
+        return false;
+    }
+
+    // The signals only set a flag, waits are short polls so that it is noticed between them.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = RequestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    printf("Serving on '%s' with a cache of %d scenes.\n", socketPath.c_str(), cacheSize);
+    fflush(stdout);
+    while (!isStopRequested) {
+        pollfd descriptor = { listener, POLLIN, 0 };
+        if (poll(&descriptor, 1, PollInterval) <= 0) {
+            continue;
+        }
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            continue;
+        }
+        SetTimeout(connection, ConnectionTimeout);
+        ServeConnection(connection, renderer);
+        close(connection);
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    scenes.clear();
+    printf("Stopped serving on '%s'.\n", socketPath.c_str());
+    return true;
+}
+
+bool RenderServer::WaitForRequest(int connection)
+{
+    // An idle client must not keep other clients waiting, nor the server from stopping.
+    auto startTime = std::chrono::steady_clock::now();
+    while (!isStopRequested) {
+        pollfd descriptor = { connection, POLLIN, 0 };
+        if (poll(&descriptor, 1, PollInterval) > 0) {
+            return true;
+        }
+        if (std::chrono::steady_clock::now() - startTime > std::chrono::milliseconds(ConnectionTimeout)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool RenderServer::ServeConnection(int connection, Renderer* renderer)
+{
+    RenderRequest request;
+    std::vector<uint8_t> frame;
+    while (WaitForRequest(connection) && ReceiveAll(connection, &request, sizeof(request))) {
+        if (request.pathLength == 0 || request.pathLength > MaxPathLength) {
+            printf("Invalid scene path length %d.\n", request.pathLength);
+            return false;
+        }
+        std::string path(request.pathLength, 0);
+        if (!ReceiveAll(connection, &path[0], path.size())) {
+            return false;
+        }
+
+        RenderResponse response = { 0, 0 };
+        std::shared_ptr<Scene> scene;
+        if (request.width == 0 || request.width > MaxFrameSize || request.height == 0 || request.height > MaxFrameSize ||
+            request.samplesCount == 0 || request.samplesCount > MaxSamplesCount) {
+            printf("Invalid frame %dx%d with %d samples for '%s'.\n", request.width, request.height, request.samplesCount, path.c_str());
+        }
+        else {
+            scene = GetScene(path, renderer);
+        }
+
+        if (scene) {
+            auto startTime = std::chrono::steady_clock::now();
+            frame.resize(4 * (size_t)request.width * request.height);
+            renderer->SetScene(scene);
+            renderer->SetSamplesCount(request.samplesCount);
+            renderer->SetFrameIndex(request.frameIndex);
+            renderer->Render(frame.data(), request.width, request.height);
+            response = { request.width, request.height };
+            double renderTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+            printf("Rendered '%s' at %dx%d with %d samples in %.2f ms.\n", path.c_str(), request.width, request.height, request.samplesCount, renderTime);
+        }
+        fflush(stdout);
+
+        if (!SendAll(connection, &response, sizeof(response)) || !SendAll(connection, frame.data(), 4 * (size_t)response.width * response.height)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<Scene> RenderServer::GetScene(const std::string& path, Renderer* renderer)
+{
+    // Any spelling of the path finds the same entry.
+    struct stat status;
+    char* resolvedPath = realpath(path.c_str(), nullptr);
+    if (!resolvedPath || stat(resolvedPath, &status) != 0) {
+        printf("Scene '%s' is not found.\n", path.c_str());
+        free(resolvedPath);
+        return nullptr;
+    }
+    std::string key = resolvedPath;
+    free(resolvedPath);
+
+    for (auto entry = scenes.begin(); entry != scenes.end(); ++entry) {
+        if (entry->path != key) {
+            continue;
+        }
+        if (entry->modificationTime.tv_sec == status.st_mtim.tv_sec && entry->modificationTime.tv_nsec == status.st_mtim.tv_nsec) {
+            scenes.splice(scenes.begin(), scenes, entry);
+            return entry->scene;
+        }
+        scenes.erase(entry);
+        break;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto scene = std::make_shared<Scene>();
+    if (!renderer->LoadScene(key.c_str(), scene.get())) {
+        printf("Cannot load scene '%s'.\n", key.c_str());
+        return nullptr;
+    }
+    if (scenes.size() >= cacheSize) {
+        scenes.pop_back();
+    }
+    scenes.push_front(CachedScene{ key, status.st_mtim, scene });
+
+    double loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    printf("Loaded '%s' in %.2f ms, %d of %d scenes are cached.\n", key.c_str(), loadTime, (int)scenes.size(), cacheSize);
+    return scene;
+}
+
+bool RenderServer::SendRequest()
+{
+    // The server resolves relative paths from its own working directory.
+    char* resolvedPath = realpath(scenePath.c_str(), nullptr);
+    if (!resolvedPath) {
+        printf("Scene '%s' is not found.\n", scenePath.c_str());
+        return false;
+    }
+    std::string path = resolvedPath;
+    free(resolvedPath);
+
+    int connection = ConnectLocal(socketPath);
+    if (connection < 0) {
+        printf("Cannot connect to '%s'.\n", socketPath.c_str());
+        return false;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    RenderRequest request = { width, height, samplesCount, frameIndex, (uint32_t)path.size() };
+    RenderResponse response;
+    std::vector<uint8_t> frame(4 * (size_t)width * height);
+    bool isReceived = SendAll(connection, &request, sizeof(request)) && SendAll(connection, path.data(), path.size()) &&
+        ReceiveAll(connection, &response, sizeof(response)) && response.width == width && response.height == height &&
+        ReceiveAll(connection, frame.data(), frame.size());
+    close(connection);
+    if (!isReceived) {
+        printf("The server did not render '%s'.\n", path.c_str());
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    printf("Received %dx%d in %.3f s.\n", width, height, seconds);
+
+    TextureLoader imageWriter;
+    if (!imageWriter.SaveImage(outputPath, frame.data(), width, height)) {
+        printf("Cannot write image '%s'.\n", outputPath.c_str());
+        return false;
+    }
+    return true;
+}
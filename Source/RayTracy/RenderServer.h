@@ -0,0 +1,94 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "Renderer.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <time.h>
+
+/*
+    Renders frames on request for scenes that stay loaded between requests. The server listens
+    on a Unix domain socket and answers the requests of one connection after another. A request
+    names a scene file, the frame size, the samples count and the frame index that seeds the
+    sample positions, and gets the frame back. Loaded scenes keep their textures, meshes and
+    hierarchies in a least recently used cache, a scene is only loaded again when it was
+    evicted or its scene file changed.
+
+    The client side sends one request and writes the frame it gets back as a PNG.
+*/
+class RenderServer
+{
+public:
+    RenderServer();
+
+    /*
+        Takes the server options out of the command line and returns the remaining arguments for
+        the renderer. A client takes all its options itself.
+    */
+    bool ParseArguments(int argc, char** argv, std::vector<char*>* arguments);
+    bool IsServer() const;
+    bool IsClient() const;
+
+    /*
+        Answers requests until SIGINT or SIGTERM, the renderer is initialized without a scene. A
+        connection is closed when its client sends or takes nothing for ConnectionTimeout.
+    */
+    bool Serve(Renderer* renderer);
+    bool SendRequest();
+
+    RenderServer(const RenderServer& other) = delete;
+    RenderServer& operator=(const RenderServer& other) = delete;
+
+private:
+    static const uint32_t MaxFrameSize;
+    static const uint32_t MaxSamplesCount;
+    static const uint32_t MaxPathLength;
+    static const int PollInterval;
+    static const int ConnectionTimeout;
+
+    /*
+        Followed by pathLength bytes of the scene path.
+    */
+    struct RenderRequest
+    {
+        uint32_t width, height;
+        uint32_t samplesCount;
+        uint32_t frameIndex;
+        uint32_t pathLength;
+    };
+
+    /*
+        Followed by width x height pixels of 4 bytes, a frame that cannot be rendered has no pixels.
+    */
+    struct RenderResponse
+    {
+        uint32_t width, height;
+    };
+
+    struct CachedScene
+    {
+        std::string path;
+        timespec modificationTime;
+        std::shared_ptr<Scene> scene;
+    };
+
+    bool isServer, isClient;
+    std::string socketPath;
+    uint32_t cacheSize;
+    // Most recently used first.
+    std::list<CachedScene> scenes;
+
+    std::string scenePath, outputPath;
+    uint32_t width, height, samplesCount, frameIndex;
+
+    bool ParseRequestArguments(const std::vector<char*>& arguments);
+    int Listen();
+    bool WaitForRequest(int connection);
+    bool ServeConnection(int connection, Renderer* renderer);
+    std::shared_ptr<Scene> GetScene(const std::string& path, Renderer* renderer);
+};
+
+#endif
@@ -1,44 +1,522 @@
 #include "Renderer.h"
 #include "SceneLoader.h"
+#include "PerformanceCounters.h"
+#include "Random.h"
 #include <iostream>
 #include <math.h>
 #include <cmath>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+const float Renderer::AdaptiveErrorRatio = 0.5f;
+
+Renderer::Renderer() :
+    maxDepth(3),
+    samplesCount(2),
+    threadsCount(0),
+    adaptiveThreshold(0),
+    maxSamples(16),
+    frameIndex(0),
+    benchmarkFrames(0),
+    benchmarkWidth(640),
+    benchmarkHeight(480),
+    acceleratorType(AcceleratorType::BVH),
+    hasAcceleratorType(false),
+    benchmarkAccelerators(false),
+    benchmarkNodeOrders(false),
+    raysCount(0),
+    primaryRaysCount(0),
+    accumulationWidth(0),
+    accumulationHeight(0),
+    accumulatedSamples(0)
+{
+}
 
-Renderer::Renderer() : maxDepth(3), samplesCount(2)
+bool Renderer::ParseArguments(int argc, char** argv, const char** scenePath)
 {
+    *scenePath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--bvh") == 0 && hasValue) {
+            auto layout = argv[++i];
+            if (strcmp(layout, "binary") == 0) {
+                hierarchyOptions.layout = BVHLayout::Binary;
+            }
+            else if (strcmp(layout, "bvh4") == 0) {
+                hierarchyOptions.layout = BVHLayout::Wide4;
+            }
+            else if (strcmp(layout, "bvh8") == 0) {
+                hierarchyOptions.layout = BVHLayout::Wide8;
+            }
+            else if (strcmp(layout, "cwbvh") == 0) {
+                hierarchyOptions.layout = BVHLayout::Compressed8;
+            }
+            else {
+                printf("Unknown BVH layout '%s'.\n", layout);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--node-order") == 0 && hasValue) {
+            auto order = argv[++i];
+            if (strcmp(order, "all") == 0) {
+                benchmarkNodeOrders = true;
+            }
+            else if (!BVH::ParseNodeOrder(order, &hierarchyOptions.nodeOrder)) {
+                printf("Unknown node order '%s'.\n", order);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--sbvh") == 0 && hasValue) {
+            hierarchyOptions.spatialSplits = true;
+            hierarchyOptions.maxDuplication = atof(argv[++i]);
+            if (hierarchyOptions.maxDuplication <= 0) {
+                printf("Cannot parse duplication '%s'.\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--accelerator") == 0 && hasValue) {
+            auto type = argv[++i];
+            if (strcmp(type, "all") == 0) {
+                benchmarkAccelerators = true;
+            }
+            else if (Accelerator::ParseType(type, &acceleratorType)) {
+                hasAcceleratorType = true;
+            }
+            else {
+                printf("Unknown accelerator '%s'.\n", type);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 && hasValue) {
+            benchmarkFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &threadsCount) != 1) {
+                printf("Cannot parse threads count '%s'.\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--adaptive") == 0 && hasValue) {
+            adaptiveThreshold = atof(argv[++i]);
+            if (adaptiveThreshold <= 0) {
+                printf("Cannot parse adaptive threshold '%s'.\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--max-samples") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%u", &maxSamples) != 1 || maxSamples == 0) {
+                printf("Cannot parse samples count '%s'.\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%ux%u", &benchmarkWidth, &benchmarkHeight) != 2 || benchmarkWidth == 0 || benchmarkHeight == 0) {
+                printf("Cannot parse size '%s'.\n", argv[i]);
+                return false;
+            }
+        }
+        else if (!*scenePath && argv[i][0] != '-') {
+            *scenePath = argv[i];
+        }
+        else {
+            printf("Unknown argument '%s'.\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
 }
 
-bool Renderer::Initialize(int argc, char** argv)
+bool Renderer::Initialize(int argc, char** argv, bool hasScene)
 {
-    if (argc != 2) {
+    const char* scenePath;
+    if (!ParseArguments(argc, argv, &scenePath)) {
+        return false;
+    }
+    // Loading the scene and building hierarchies use as many threads as rendering.
+    hierarchyOptions.threadsCount = threadsCount;
+
+    if (!hasScene && scenePath) {
+        printf("Unexpected scene path '%s'.\n", scenePath);
+        return false;
+    }
+    if (hasScene && !scenePath) {
         printf("Specify scene file path.\n");
+        printf("Usage: RayTracy <scene> [--accelerator bvh|grid|kdtree|all] [--bvh binary|bvh4|bvh8|cwbvh] [--sbvh <max duplication>] [--node-order build|dfs|treelet|all] [--threads <count>] [--farm <workers> --output <image.png>] [--adaptive <threshold>] [--max-samples <count>] [--benchmark <frames>] [--size <width>x<height>]\n");
+        printf("       RayTracy --serve <socket> [--cache-size <scenes>] [options]\n");
+        printf("       RayTracy --connect <socket> <scene> [--size <width>x<height>] [--samples <count>] [--frame <index>] --output <image.png>\n");
         return false;
     }
 
+    if (benchmarkAccelerators && !IsBenchmark()) {
+        printf("Accelerator 'all' is only available with --benchmark.\n");
+        return false;
+    }
+
+    // Orders are applied one after another to the loaded trees, the build order cannot be restored.
+    if (benchmarkNodeOrders && (!IsBenchmark() || benchmarkAccelerators)) {
+        printf("Node order 'all' is only available with --benchmark and a single accelerator.\n");
+        return false;
+    }
+
+    if (hasScene) {
+        scene = std::make_shared<Scene>();
+        if (!LoadScene(scenePath, scene.get())) {
+            return false;
+        }
+    }
+
+    threadPool.Start(threadsCount);
+    printf("Rendering with %d threads.\n", threadPool.GetThreadsCount());
+    return true;
+}
+
+bool Renderer::LoadScene(const char* path, Scene* scene)
+{
     SceneLoader loader;
-    return loader.LoadScene(argv[1], &scene);
+    return loader.LoadScene(path, scene, hierarchyOptions, hasAcceleratorType ? &acceleratorType : nullptr);
+}
+
+void Renderer::SetScene(const std::shared_ptr<Scene>& scene)
+{
+    // Tile costs carry over to the next frame of the same scene.
+    if (this->scene == scene) {
+        return;
+    }
+    this->scene = scene;
+    tileCosts.clear();
+    ResetAccumulation();
+}
+
+void Renderer::SetSamplesCount(uint32_t samplesCount)
+{
+    this->samplesCount = samplesCount;
+}
+
+bool Renderer::Render(uint8_t* buffer, uint32_t width, uint32_t height, const CancellationToken* cancellation)
+{
+    // Every pixel depends only on its own samples, so the image does not depend on the threads count.
+    if (adaptiveThreshold <= 0) {
+        return RenderTiles(width, 0, height, [&](uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) {
+            RenderTile(buffer, 0, width, height, tileX, tileY, raysCount, primaryRaysCount);
+        }, cancellation);
+    }
+
+    // The refinement compares each pixel with its neighbours, so all first samples are traced first.
+    firstSamples.resize(width * height);
+    bool isFinished = RenderTiles(width, 0, height, [&](uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) {
+        TraceFirstSamples(width, height, tileX, tileY, raysCount, primaryRaysCount);
+    }, cancellation);
+    return isFinished && RenderTiles(width, 0, height, [&](uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) {
+        RefineTile(buffer, width, height, tileX, tileY, raysCount, primaryRaysCount);
+    }, cancellation);
 }
 
-void Renderer::Render(uint8_t* buffer, uint32_t width, uint32_t height)
+bool Renderer::RenderRows(uint8_t* buffer, uint32_t width, uint32_t height, uint32_t beginY, uint32_t endY)
+{
+    if (adaptiveThreshold > 0 || beginY % TileSize != 0 || beginY >= endY || endY > height) {
+        return false;
+    }
+    return RenderTiles(width, beginY, endY, [&](uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) {
+        RenderTile(buffer, beginY, width, height, tileX, tileY, raysCount, primaryRaysCount);
+    }, nullptr);
+}
+
+bool Renderer::RenderProgressive(uint8_t* buffer, uint32_t width, uint32_t height, const CancellationToken* cancellation)
+{
+    if (width != accumulationWidth || height != accumulationHeight) {
+        accumulationWidth = width;
+        accumulationHeight = height;
+        accumulation.assign(width * height, Vector3());
+        accumulatedSamples = 0;
+    }
+    if (accumulatedSamples >= MaxAccumulatedSamples) {
+        return false;
+    }
+    if (accumulatedSamples == 0) {
+        std::fill(accumulation.begin(), accumulation.end(), Vector3());
+    }
+
+    uint32_t sample = accumulatedSamples++;
+
+    // Cancelled passes added a sample only to some of the pixels.
+    bool isFinished = RenderTiles(width, 0, height, [&](uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) {
+        AccumulateTile(buffer, width, height, tileX, tileY, sample, raysCount, primaryRaysCount);
+    }, cancellation);
+    if (!isFinished) {
+        ResetAccumulation();
+    }
+    return isFinished;
+}
+
+void Renderer::ResetAccumulation()
+{
+    accumulatedSamples = 0;
+}
+
+bool Renderer::RenderTiles(uint32_t width, uint32_t beginY, uint32_t endY, const TileFunction& function, const CancellationToken* cancellation)
+{
+    scene->UpdateAccelerator();
+
+    uint32_t tilesX = (width + TileSize - 1) / TileSize;
+    uint32_t firstTileY = beginY / TileSize;
+    uint32_t tilesY = (endY + TileSize - 1) / TileSize - firstTileY;
+    uint32_t tilesCount = tilesX * tilesY;
+    std::vector<uint32_t> tiles(tilesCount);
+    for (uint32_t i = 0; i < tilesCount; i++) {
+        tiles[i] = i;
+    }
+
+    // Consecutive frames are similar, tiles that were expensive in the last one are started first.
+    if (tileCosts.size() == tilesCount) {
+        std::stable_sort(tiles.begin(), tiles.end(), [this](uint32_t a, uint32_t b) { return tileCosts[a] > tileCosts[b]; });
+    }
+    else {
+        tileCosts.assign(tilesCount, 0);
+    }
+
+    std::vector<uint64_t> threadRaysCounts(threadPool.GetThreadsCount(), 0);
+    std::vector<uint64_t> threadPrimaryRaysCounts(threadPool.GetThreadsCount(), 0);
+    threadPool.Run(tiles, [&](uint32_t tile, uint32_t thread) {
+        // Skipped tiles keep their cost from the last frame.
+        if (cancellation && cancellation->load(std::memory_order_relaxed)) {
+            return;
+        }
+        auto startTime = std::chrono::steady_clock::now();
+        function((tile % tilesX) * TileSize, (firstTileY + tile / tilesX) * TileSize, &threadRaysCounts[thread], &threadPrimaryRaysCounts[thread]);
+        tileCosts[tile] = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+    });
+
+    for (uint32_t i = 0; i < threadRaysCounts.size(); i++) {
+        raysCount += threadRaysCounts[i];
+        primaryRaysCount += threadPrimaryRaysCounts[i];
+    }
+    return !cancellation || !cancellation->load();
+}
+
+void Renderer::RenderTile(uint8_t* buffer, uint32_t bufferY, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) const
 {
     uint32_t sampleWidth = width * samplesCount;
     uint32_t sampleHeight = height * samplesCount;
     float averageFactor = (1.0f / (samplesCount * samplesCount));
-    for (uint32_t y = 0; y < height; y++)
+    float stratumSize = 1.0f / samplesCount;
+    uint32_t endX = std::min(tileX + TileSize, width);
+    uint32_t endY = std::min(tileY + TileSize, height);
+    uint64_t tileRaysCount = 0;
+    for (uint32_t y = tileY; y < endY; y++)
     {
-        for (uint32_t x = 0; x < width; x++)
+        for (uint32_t x = tileX; x < endX; x++)
         {
+            // One jittered sample in every cell of the samplesCount x samplesCount grid.
             Vector3 sum { 0, 0, 0 };
             for (uint32_t dx = 0; dx < samplesCount; dx++) {
                 for (uint32_t dy = 0; dy < samplesCount; dy++) {
-                    auto ray = GetPrimaryRay(sampleWidth, sampleHeight, x * samplesCount + dx, y * samplesCount + dy, PI / 4);
-                    sum = sum + CastRay(ray, 0, sampleWidth * sampleHeight);
+                    CounterRandom random(x, y, dy * samplesCount + dx, frameIndex);
+                    float sampleX = x + (dx + random.Next()) * stratumSize;
+                    float sampleY = y + (dy + random.Next()) * stratumSize;
+                    auto ray = GetPrimaryRay(width, height, sampleX, sampleY, PI / 4);
+                    sum = sum + CastRay(ray, 0, sampleWidth * sampleHeight, &tileRaysCount);
                 }
             }
 
+            SetPixel(buffer, width, x, y - bufferY, sum * averageFactor);
+        }
+    }
+    *raysCount += tileRaysCount;
+    *primaryRaysCount += (endX - tileX) * (endY - tileY) * samplesCount * samplesCount;
+}
+
+void Renderer::TraceFirstSamples(uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount)
+{
+    uint32_t resolution = width * samplesCount * height * samplesCount;
+    uint32_t endX = std::min(tileX + TileSize, width);
+    uint32_t endY = std::min(tileY + TileSize, height);
+    uint64_t tileRaysCount = 0;
+    for (uint32_t y = tileY; y < endY; y++) {
+        for (uint32_t x = tileX; x < endX; x++) {
+            auto offset = GetSampleOffset(x, y, 0);
+            auto ray = GetPrimaryRay(width, height, x + offset.x, y + offset.y, PI / 4);
+            firstSamples[y * width + x] = CastRay(ray, 0, resolution, &tileRaysCount);
+        }
+    }
+    *raysCount += tileRaysCount;
+    *primaryRaysCount += (endX - tileX) * (endY - tileY);
+}
+
+void Renderer::RefineTile(uint8_t* buffer, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount)
+{
+    const Vector3 luminance(0.2126f, 0.7152f, 0.0722f);
+    uint32_t resolution = width * samplesCount * height * samplesCount;
+    float maxError = adaptiveThreshold * AdaptiveErrorRatio;
+    uint32_t endX = std::min(tileX + TileSize, width);
+    uint32_t endY = std::min(tileY + TileSize, height);
+    uint64_t tileRaysCount = 0, tilePrimaryRaysCount = 0;
+    for (uint32_t y = tileY; y < endY; y++) {
+        for (uint32_t x = tileX; x < endX; x++) {
+            auto sum = firstSamples[y * width + x];
+            uint32_t count = 1;
+            if (HasContrast(width, height, x, y)) {
+                // Welford's running variance of the luminance decides when the mean is good enough.
+                float mean = Dot(sum, luminance), m2 = 0;
+                while (count < maxSamples) {
+                    auto offset = GetSampleOffset(x, y, count);
+                    auto ray = GetPrimaryRay(width, height, x + offset.x, y + offset.y, PI / 4);
+                    auto color = CastRay(ray, 0, resolution, &tileRaysCount);
+                    sum = sum + color;
+                    count++;
+
+                    float value = Dot(color, luminance);
+                    float delta = value - mean;
+                    mean += delta / count;
+                    m2 += delta * (value - mean);
+                    if (count % AdaptiveBatchSize == 0 && sqrtf(m2 / ((count - 1) * count)) < maxError) {
+                        break;
+                    }
+                }
+                tilePrimaryRaysCount += count - 1;
+            }
+            SetPixel(buffer, width, x, y, sum * (1.0f / count));
+        }
+    }
+    *raysCount += tileRaysCount;
+    *primaryRaysCount += tilePrimaryRaysCount;
+}
+
+bool Renderer::HasContrast(uint32_t width, uint32_t height, uint32_t x, uint32_t y) const
+{
+    auto& center = firstSamples[y * width + x];
+    auto differs = [&](uint32_t neighbourX, uint32_t neighbourY) {
+        auto& neighbour = firstSamples[neighbourY * width + neighbourX];
+        return fabsf(center.x - neighbour.x) > adaptiveThreshold || fabsf(center.y - neighbour.y) > adaptiveThreshold ||
+            fabsf(center.z - neighbour.z) > adaptiveThreshold;
+    };
+    return (x > 0 && differs(x - 1, y)) || (x + 1 < width && differs(x + 1, y)) ||
+        (y > 0 && differs(x, y - 1)) || (y + 1 < height && differs(x, y + 1));
+}
+
+void Renderer::AccumulateTile(uint8_t* buffer, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint32_t sample, uint64_t* raysCount, uint64_t* primaryRaysCount)
+{
+    // Same texture filtering as Render, so the accumulated image converges to a similar look.
+    uint32_t resolution = width * samplesCount * height * samplesCount;
+    float averageFactor = 1.0f / accumulatedSamples;
+    uint32_t endX = std::min(tileX + TileSize, width);
+    uint32_t endY = std::min(tileY + TileSize, height);
+    uint64_t tileRaysCount = 0;
+    for (uint32_t y = tileY; y < endY; y++) {
+        for (uint32_t x = tileX; x < endX; x++) {
+            auto offset = GetSampleOffset(x, y, sample);
+            auto ray = GetPrimaryRay(width, height, x + offset.x, y + offset.y, PI / 4);
+            auto& sum = accumulation[y * width + x];
+            sum = sum + CastRay(ray, 0, resolution, &tileRaysCount);
             SetPixel(buffer, width, x, y, sum * averageFactor);
         }
     }
+    *raysCount += tileRaysCount;
+    *primaryRaysCount += (endX - tileX) * (endY - tileY);
+}
+
+bool Renderer::SetObjectTransformation(uint32_t object, Vector3 position, Vector3 rotation, float scale)
+{
+    if (!scene->SetTransformation(object, position, rotation, scale)) {
+        return false;
+    }
+    ResetAccumulation();
+    return true;
+}
+
+bool Renderer::SetSphereCenter(uint32_t object, Vector3 center)
+{
+    if (!scene->SetCenter(object, center)) {
+        return false;
+    }
+    ResetAccumulation();
+    return true;
+}
+
+void Renderer::SetFrameIndex(uint32_t frameIndex)
+{
+    this->frameIndex = frameIndex;
+}
+
+bool Renderer::IsBenchmark() const
+{
+    return benchmarkFrames > 0;
+}
+
+void Renderer::RunBenchmark()
+{
+    if (!benchmarkAccelerators) {
+        BenchmarkNodeOrders();
+        return;
+    }
+
+    for (auto type : { AcceleratorType::BVH, AcceleratorType::Grid, AcceleratorType::KdTree }) {
+        auto startTime = std::chrono::steady_clock::now();
+        scene->BuildAccelerator(type, hierarchyOptions);
+        double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+        printf("Accelerator %s built in %.2f ms. ", Accelerator::GetTypeName(type), buildTime);
+        BenchmarkFrames();
+    }
+}
+
+void Renderer::BenchmarkNodeOrders()
+{
+    if (!benchmarkNodeOrders) {
+        BenchmarkFrames();
+        return;
+    }
+
+    for (auto order : { BVHNodeOrder::Build, BVHNodeOrder::DepthFirst, BVHNodeOrder::Treelet }) {
+        scene->ReorderHierarchies(order);
+        printf("Node order %s. ", BVH::GetNodeOrderName(order));
+        BenchmarkFrames();
+    }
+}
+
+void Renderer::BenchmarkFrames()
+{
+    std::vector<uint8_t> buffer(benchmarkWidth * benchmarkHeight * 4);
+    PerformanceCounters counters;
+    raysCount = 0;
+
+    // The first frame warms up the caches and is not measured.
+    Render(buffer.data(), benchmarkWidth, benchmarkHeight);
+    raysCount = 0;
+    primaryRaysCount = 0;
+
+    // Counters follow only threads created after they are enabled, restart the workers to include them.
+    bool hasCounters = counters.Start();
+    threadPool.Start(threadsCount);
+    // Like frames of an animation, every frame samples other positions.
+    auto startTime = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < benchmarkFrames; i++) {
+        SetFrameIndex(i);
+        Render(buffer.data(), benchmarkWidth, benchmarkHeight);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    counters.Stop();
+    SetFrameIndex(0);
+
+    printf("Rendered %d frames of %dx%d in %.3f s: %.2f ms per frame, %.3f Mrays/s, %.2f primary rays per pixel.", 
+        benchmarkFrames, benchmarkWidth, benchmarkHeight, seconds, seconds * 1000 / benchmarkFrames, raysCount / seconds / 1000000,
+        (double)primaryRaysCount / ((double)benchmarkFrames * benchmarkWidth * benchmarkHeight));
+
+    if (!hasCounters) {
+        printf(" Cache miss counters are unavailable.\n");
+        return;
+    }
+    for (auto event : { PerformanceEvent::L1DataMisses, PerformanceEvent::LastLevelMisses }) {
+        const char* name = event == PerformanceEvent::L1DataMisses ? "L1D" : "LLC";
+        if (counters.IsAvailable(event)) {
+            printf(" %s misses per ray %.2f.", name, raysCount > 0 ? (double)counters.GetValue(event) / raysCount : 0.0);
+        }
+        else {
+            printf(" %s misses unavailable.", name);
+        }
+    }
+    printf("\n");
 }
 
 Vector3 Renderer::RestrictColor(Vector3 color) const
@@ -58,28 +536,20 @@ Vector3 Renderer::RestrictColor(Vector3 color) const
     return color;
 }
 
-Vector3 Renderer::CastRay(Ray ray, uint32_t depth, uint32_t resolution) const
+Vector3 Renderer::CastRay(Ray ray, uint32_t depth, uint32_t resolution, uint64_t* raysCount) const
 {
     Material material;
     Vector3 normal;
     
-    float minDistance = INFINITY, minU, minV;
-    bool hasIntersection = false;
-
-    for (auto& object : scene.objects) {
-        float distance, u, v;
-        Vector3 n;
-        if (object->HasIntersection(ray, &distance, &n, &u, &v) && distance < minDistance) {
-            hasIntersection = true;
-            material = object->material;
-            minDistance = distance;
-            normal = n;
-            minU = u;
-            minV = v;
-        }
+    (*raysCount)++;
+    float minDistance, minU, minV;
+    auto object = scene->FindIntersection(ray, &minDistance, &normal, &minU, &minV);
+    bool hasIntersection = object != nullptr;
+    if (hasIntersection) {
+        material = object->material;
     }
 
-    auto color = hasIntersection ? CalculateColor(material, normal, ray, minDistance, minU, minV, resolution) : scene.backgroundColor;
+    auto color = hasIntersection ? CalculateColor(material, normal, ray, minDistance, minU, minV, resolution, raysCount) : scene->backgroundColor;
     if (hasIntersection) {
         float kr = material.reflectivity;
         if (material.ior > 1 && depth < maxDepth) {
@@ -89,7 +559,7 @@ Vector3 Renderer::CastRay(Ray ray, uint32_t depth, uint32_t resolution) const
                 auto bias = normal * 0.0001;
                 auto point = (ray.origin + ray.direction * minDistance);
                 refracted.origin = outside ? point - bias : point + bias;
-                auto refractedColor = CastRay(refracted, depth + 1, resolution);
+                auto refractedColor = CastRay(refracted, depth + 1, resolution, raysCount);
                 color = color + refractedColor * (1 - kr);
             }
         }
@@ -98,7 +568,7 @@ Vector3 Renderer::CastRay(Ray ray, uint32_t depth, uint32_t resolution) const
             reflected.direction = ray.direction - normal * (2 * Dot(normal, ray.direction));
             reflected.direction.Normalize();
             reflected.origin = (ray.origin + ray.direction * minDistance) + reflected.direction * 0.0001;
-            auto reflectedColor = CastRay(reflected, depth + 1, resolution);
+            auto reflectedColor = CastRay(reflected, depth + 1, resolution, raysCount);
             color = color + reflectedColor * kr;
         }
     }
@@ -135,10 +605,10 @@ Vector4 Renderer::FilterTexture(const Texture& texture, float x, float y, float
 Vector3 Renderer::GetMaterialColor(Material material, float u, float v, float distance, uint32_t resolution) const
 {
     auto color = material.color;
-    if (material.texture >= 0 && material.texture < scene.textures.size()) {
+    if (material.texture >= 0 && material.texture < scene->textures.size()) {
         float texX = u * material.textureScale;
         float texY = v * material.textureScale;
-        auto& texture = scene.textures[material.texture];
+        auto& texture = scene->textures[material.texture];
         auto textureColor = texture.HasMipmap() ? FilterTexture(texture, texX, texY, distance, resolution, material.textureScale, material.mipBias) : texture.GetPixel(texX, texY);
         
         color.x *= textureColor.x;
@@ -148,12 +618,12 @@ Vector3 Renderer::GetMaterialColor(Material material, float u, float v, float di
     return color;
 }
 
-Vector3 Renderer::CalculateColor(Material material, Vector3 normal, Ray ray, float distance, float u, float v, uint32_t resolution) const
+Vector3 Renderer::CalculateColor(Material material, Vector3 normal, Ray ray, float distance, float u, float v, uint32_t resolution, uint64_t* raysCount) const
 {
     auto point = ray.origin + ray.direction * distance;
     auto materialColor = GetMaterialColor(material, u, v, distance, resolution);
     auto color = materialColor * material.Ka;
-    for (auto light : scene.lights) {
+    for (auto light : scene->lights) {
         auto toLight = light.position - point;
         float distanceToLight = toLight.GetLength();
         toLight.Normalize();
@@ -162,7 +632,7 @@ Vector3 Renderer::CalculateColor(Material material, Vector3 normal, Ray ray, flo
         rayToLight.origin = point + toLight * 0.0001;
         rayToLight.direction = toLight;
 
-        if (CheckIntersection(rayToLight, distanceToLight)) {
+        if (CheckIntersection(rayToLight, distanceToLight, raysCount)) {
             continue;
         }
 
@@ -186,15 +656,10 @@ Vector3 Renderer::CalculateColor(Material material, Vector3 normal, Ray ray, flo
     return RestrictColor(color);
 }
 
-bool Renderer::CheckIntersection(Ray ray, float maxDistance) const
+bool Renderer::CheckIntersection(Ray ray, float maxDistance, uint64_t* raysCount) const
 {
-    float distance;
-    for (auto& object : scene.objects) {
-        if (object->HasIntersection(ray, &distance) && distance < maxDistance) {
-            return true;
-        }
-    }
-    return false;
+    (*raysCount)++;
+    return scene->IsOccluded(ray, maxDistance);
 }
 
 uint8_t Renderer::ToByte(float value) const
@@ -212,11 +677,23 @@ uint8_t Renderer::ToByte(float value) const
     return integer;
 }
 
-Ray Renderer::GetPrimaryRay(uint32_t width, uint32_t height, uint32_t x, uint32_t y, float fov) const
+Vector2 Renderer::GetSampleOffset(uint32_t x, uint32_t y, uint32_t sample) const
+{
+    // The R2 sequence spreads consecutive samples evenly over the pixel. A random shift per pixel
+    // keeps neighbouring pixels from sharing the same pattern.
+    const float alpha1 = 0.7548776662f, alpha2 = 0.5698402910f;
+    CounterRandom random(x, y, SampleOffsetStream, frameIndex);
+    Vector2 offset(random.Next() + sample * alpha1, random.Next() + sample * alpha2);
+    offset.x -= floorf(offset.x);
+    offset.y -= floorf(offset.y);
+    return offset;
+}
+
+Ray Renderer::GetPrimaryRay(uint32_t width, uint32_t height, float x, float y, float fov) const
 {
     float ratio = (float)width / height;
-    float screenX = 2 * (float)x / width - 1;
-    float screenY = 1 - 2 * (float)y / height;
+    float screenX = 2 * x / width - 1;
+    float screenY = 1 - 2 * y / height;
 
     if (width > height) {
         screenX *= ratio;
@@ -284,7 +761,6 @@ bool Renderer::Refract(Vector3 direction, Vector3 normal, float ior, Vector3* re
 
 void Renderer::CleanUp()
 {
-    scene.textures.clear();
-    scene.objects.clear();
-    scene.lights.clear();
+    threadPool.Stop();
+    scene.reset();
 }
\ No newline at end of file
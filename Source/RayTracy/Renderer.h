@@ -2,31 +2,119 @@
 #define RENDERER_H
 
 #include "Scene.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+typedef std::atomic<bool> CancellationToken;
 
 class Renderer
 {
 public:
+    static const uint32_t TileSize = 32;
+
     Renderer();
 
-    bool Initialize(int argc, char** argv);
-    void Render(uint8_t* buffer, uint32_t width, uint32_t height);
+    /*
+        Parses the options and loads the scene. Without hasScene no scene path is taken, and one
+        is set with SetScene before rendering.
+    */
+    bool Initialize(int argc, char** argv, bool hasScene = true);
+    /*
+        Loads a scene with the hierarchy and accelerator options of the command line.
+    */
+    bool LoadScene(const char* path, Scene* scene);
+    void SetScene(const std::shared_ptr<Scene>& scene);
+    void SetSamplesCount(uint32_t samplesCount);
+    /*
+        Traces one jittered ray in every cell of a samplesCount x samplesCount grid per pixel, or
+        with --adaptive one ray per pixel first and then more rays only for pixels that differ
+        from their neighbours by more than the threshold. Those get up to maxSamples rays and stop
+        early once the standard error of their mean drops below AdaptiveErrorRatio of the threshold.
+
+        Setting cancellation from another thread skips the tiles that have not started yet and
+        makes Render return false, the buffer is then only partially updated.
+    */
+    bool Render(uint8_t* buffer, uint32_t width, uint32_t height, const CancellationToken* cancellation = nullptr);
+    /*
+        Renders the rows [beginY, endY) of a width x height frame into a buffer holding only those
+        rows, the same pixels Render writes there. beginY is a multiple of TileSize and endY too
+        unless it is the height. Adaptive sampling compares pixels with the rows around them, so
+        this returns false for it.
+    */
+    bool RenderRows(uint8_t* buffer, uint32_t width, uint32_t height, uint32_t beginY, uint32_t endY);
+    /*
+        Adds one sample per pixel at a new sub-pixel position to an accumulation buffer and writes
+        the average of all samples so far. Accumulation restarts when the size changes or objects
+        move. Returns false without rendering once MaxAccumulatedSamples are accumulated, and when
+        cancelled, which also restarts the accumulation.
+    */
+    bool RenderProgressive(uint8_t* buffer, uint32_t width, uint32_t height, const CancellationToken* cancellation = nullptr);
+    void ResetAccumulation();
+    /*
+        Sample positions are random but depend only on the pixel, the sample and the frame index,
+        so a frame renders the same for any threads count. Defaults to 0.
+    */
+    void SetFrameIndex(uint32_t frameIndex);
+
+    /*
+        Move scene objects between Render calls, the object index is the order in the scene file.
+        The scene hierarchy is refitted at the start of the next Render.
+    */
+    bool SetObjectTransformation(uint32_t object, Vector3 position, Vector3 rotation, float scale);
+    bool SetSphereCenter(uint32_t object, Vector3 center);
+
+    bool IsBenchmark() const;
+    void RunBenchmark();
     void CleanUp();
 
     Renderer(const Renderer& other) = delete;
     Renderer& operator=(const Renderer& other) = delete;
 
 private:
-    Scene scene;
-    uint32_t maxDepth, samplesCount;
+    static const uint32_t MaxAccumulatedSamples = 256;
+    static const uint32_t AdaptiveBatchSize = 4;
+    static const float AdaptiveErrorRatio;
+    // Random stream of the per-pixel shift, above the stream of any grid sample.
+    static const uint32_t SampleOffsetStream = UINT32_MAX;
+
+    typedef std::function<void(uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount)> TileFunction;
+
+    std::shared_ptr<Scene> scene;
+    ThreadPool threadPool;
+    uint32_t maxDepth, samplesCount, threadsCount;
+    float adaptiveThreshold;
+    uint32_t maxSamples;
+    uint32_t frameIndex;
+    BVHBuildOptions hierarchyOptions;
+    uint32_t benchmarkFrames, benchmarkWidth, benchmarkHeight;
+    AcceleratorType acceleratorType;
+    bool hasAcceleratorType, benchmarkAccelerators, benchmarkNodeOrders;
+    uint64_t raysCount;
+    uint64_t primaryRaysCount;
+    std::vector<float> tileCosts;
+    std::vector<Vector3> accumulation;
+    uint32_t accumulationWidth, accumulationHeight, accumulatedSamples;
+    std::vector<Vector3> firstSamples;
+
+    bool ParseArguments(int argc, char** argv, const char** scenePath);
+    void BenchmarkNodeOrders();
+    void BenchmarkFrames();
+    bool RenderTiles(uint32_t width, uint32_t beginY, uint32_t endY, const TileFunction& function, const CancellationToken* cancellation);
+    void RenderTile(uint8_t* buffer, uint32_t bufferY, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount) const;
+    void TraceFirstSamples(uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount);
+    void RefineTile(uint8_t* buffer, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint64_t* raysCount, uint64_t* primaryRaysCount);
+    bool HasContrast(uint32_t width, uint32_t height, uint32_t x, uint32_t y) const;
+    void AccumulateTile(uint8_t* buffer, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint32_t sample, uint64_t* raysCount, uint64_t* primaryRaysCount);
 
     Vector4 FilterTexture(const Texture& texture, float x, float y, float distance, uint32_t resolution, float textureScale, float mipBias) const;
     Vector3 RestrictColor(Vector3 color) const;
     bool Refract(Vector3 direction, Vector3 normal, float ior, Vector3* refracted, float* kr) const;
-    Vector3 CastRay(Ray ray, uint32_t depth, uint32_t screenWidth) const;
-    Ray GetPrimaryRay(uint32_t width, uint32_t height, uint32_t x, uint32_t y, float fov) const;
+    Vector3 CastRay(Ray ray, uint32_t depth, uint32_t screenWidth, uint64_t* raysCount) const;
+    Vector2 GetSampleOffset(uint32_t x, uint32_t y, uint32_t sample) const;
+    Ray GetPrimaryRay(uint32_t width, uint32_t height, float x, float y, float fov) const;
     void SetPixel(uint8_t* buffer, uint32_t width, uint32_t x, uint32_t y, Vector3 color) const;
-    Vector3 CalculateColor(Material material, Vector3 normal, Ray ray, float distance, float u, float v, uint32_t screenWidth) const;
-    bool CheckIntersection(Ray ray, float maxDistance) const;
+    Vector3 CalculateColor(Material material, Vector3 normal, Ray ray, float distance, float u, float v, uint32_t screenWidth, uint64_t* raysCount) const;
+    bool CheckIntersection(Ray ray, float maxDistance, uint64_t* raysCount) const;
     uint8_t ToByte(float value) const;
     Vector3 GetMaterialColor(Material material, float u, float v, float distance, uint32_t screenWidth) const;
 };
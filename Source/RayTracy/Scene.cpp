@@ -0,0 +1,136 @@
+#include "Scene.h"
+#include "BVHAccelerator.h"
+#include <unordered_set>
+
+void Scene::GetBoundingBoxes(std::vector<BoundingBox>* boxes)
+{
+    boxes->clear();
+    boundedObjects.clear();
+    unboundedObjects.clear();
+
+    for (uint32_t i = 0; i < objects.size(); i++) {
+        BoundingBox box;
+        if (objects[i]->GetBoundingBox(&box)) {
+            boxes->push_back(box);
+            boundedObjects.push_back(i);
+        }
+        else {
+            unboundedObjects.push_back(i);
+        }
+    }
+}
+
+void Scene::BuildAccelerator(AcceleratorType type, const BVHBuildOptions& options)
+{
+    std::vector<BoundingBox> boxes;
+    GetBoundingBoxes(&boxes);
+
+    acceleratorType = type;
+    accelerator = Accelerator::Create(type, options);
+    accelerator->Build(boxes);
+    objectsChanged = false;
+}
+
+bool Scene::UpdateAccelerator()
+{
+    if (!objectsChanged || !accelerator) {
+        return false;
+    }
+    objectsChanged = false;
+
+    std::vector<BoundingBox> boxes;
+    GetBoundingBoxes(&boxes);
+    return accelerator->Update(boxes);
+}
+
+void Scene::ReorderHierarchies(BVHNodeOrder order)
+{
+    // Instances share their geometry, which is reordered once.
+    std::unordered_set<MeshData*> reordered;
+    for (auto& object : objects) {
+        auto mesh = dynamic_cast<Mesh*>(object.get());
+        if (mesh && reordered.insert(mesh->data.get()).second) {
+            mesh->data->hierarchy.Reorder(order);
+        }
+    }
+
+    auto hierarchyAccelerator = dynamic_cast<BVHAccelerator*>(accelerator.get());
+    if (hierarchyAccelerator) {
+        hierarchyAccelerator->Reorder(order);
+    }
+}
+
+bool Scene::SetTransformation(uint32_t object, Vector3 position, Vector3 rotation, float scale)
+{
+    auto mesh = object < objects.size() ? dynamic_cast<Mesh*>(objects[object].get()) : nullptr;
+    if (!mesh) {
+        return false;
+    }
+    mesh->SetTransformation(position, rotation, scale);
+    objectsChanged = true;
+    return true;
+}
+
+bool Scene::SetCenter(uint32_t object, Vector3 center)
+{
+    auto sphere = object < objects.size() ? dynamic_cast<Sphere*>(objects[object].get()) : nullptr;
+    if (!sphere) {
+        return false;
+    }
+    sphere->center = center;
+    objectsChanged = true;
+    return true;
+}
+
+const Object* Scene::FindIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v) const
+{
+    const Object* closestObject = nullptr;
+    float minDistance = INFINITY;
+
+    auto intersector = [&](uint32_t index, float& maxDistance) {
+        float distance, cu, cv;
+        Vector3 n;
+        auto object = objects[index].get();
+        if (!object->HasIntersection(ray, &distance, &n, &cu, &cv) || distance >= maxDistance) {
+            return false;
+        }
+        closestObject = object;
+        maxDistance = minDistance = distance;
+        *normal = n;
+        *u = cu;
+        *v = cv;
+        return true;
+    };
+
+    // Unbounded objects are cheap analytic tests, their closest hit clips the accelerator traversal.
+    for (auto index : unboundedObjects) {
+        intersector(index, minDistance);
+    }
+
+    if (accelerator) {
+        auto boundedIntersector = [&](uint32_t primitive, float& maxDistance) {
+            return intersector(boundedObjects[primitive], maxDistance);
+        };
+        accelerator->Intersect(ray, minDistance, boundedIntersector);
+    }
+
+    if (closestObject) {
+        *t = minDistance;
+    }
+
+    return closestObject;
+}
+
+bool Scene::IsOccluded(Ray ray, float maxDistance) const
+{
+    for (auto index : unboundedObjects) {
+        if (objects[index]->IsOccluded(ray, maxDistance)) {
+            return true;
+        }
+    }
+
+    auto intersector = [&](uint32_t primitive, float maxDistance) {
+        return objects[boundedObjects[primitive]]->IsOccluded(ray, maxDistance);
+    };
+    return accelerator && accelerator->IsOccluded(ray, maxDistance, intersector);
+}
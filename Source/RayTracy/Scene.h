@@ -3,6 +3,7 @@
 
 #include "Geometry.h"
 #include "Texture.h"
+#include "Accelerator.h"
 #include <vector>
 #include <memory>
 
@@ -19,10 +20,40 @@ struct Scene
     std::vector<Light> lights;
     std::vector<Texture> textures;
 
-    Scene() {}
+    AcceleratorType acceleratorType;
+    std::unique_ptr<Accelerator> accelerator;
+    bool objectsChanged;
+    std::vector<uint32_t> boundedObjects;
+    std::vector<uint32_t> unboundedObjects;
+
+    Scene() : acceleratorType{ AcceleratorType::BVH }, objectsChanged{ false } {}
+
+    /*
+        Collects the boxes of bounded objects, the accelerator primitive i is boundedObjects[i].
+        Objects without a box, like planes, are listed in unboundedObjects and tested separately.
+    */
+    void GetBoundingBoxes(std::vector<BoundingBox>* boxes);
+    void BuildAccelerator(AcceleratorType type, const BVHBuildOptions& options = BVHBuildOptions());
+
+    /*
+        Brings the accelerator up to date after objects were moved. Returns true when it was
+        rebuilt rather than refitted.
+    */
+    bool UpdateAccelerator();
+
+    /*
+        Changes the node order of every mesh hierarchy and of a BVH accelerator in place.
+    */
+    void ReorderHierarchies(BVHNodeOrder order);
+
+    bool SetTransformation(uint32_t object, Vector3 position, Vector3 rotation, float scale);
+    bool SetCenter(uint32_t object, Vector3 center);
+
+    const Object* FindIntersection(Ray ray, float* t, Vector3* normal, float* u, float* v) const;
+    bool IsOccluded(Ray ray, float maxDistance) const;
 
     Scene(const Scene&) = delete;
     Scene& operator=(const Scene&) = delete;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,18 +4,67 @@
 #include "Scene.h"
 #include "TextureLoader.h"
 #include "MeshLoader.h"
+#include "BVHCache.h"
+#include "Tokenizer.h"
 #include <stdio.h>
 #include <string>
+#include <unordered_map>
+#include <memory>
 
+/*
+    Loads a scene in two steps. The .scn file is parsed first, referenced texture and mesh files
+    are only recorded as jobs. The jobs then decode the files, generate mipmaps and build or load
+    hierarchies on a thread pool, and the mesh transformations are set once all hierarchies exist.
+*/
 class SceneLoader
 {
 private:
     static const uint32_t LineLength;
     static const uint32_t TokenLength;
     static const char* Delimiters;
+    static const uint32_t TexelsPerTriangle;
+
+    struct TextureJob
+    {
+        uint32_t texture;
+        std::string path;
+        bool mipmap;
+    };
+
+    /*
+        An instance only reuses the geometry of an earlier mesh, its job just keeps its message in
+        file order. The cache path, key and statistics are kept between loading and building.
+    */
+    struct MeshJob
+    {
+        std::shared_ptr<MeshData> data;
+        std::string path;
+        uint32_t lineNumber;
+        std::string message;
+        bool instance;
+        std::string cachePath;
+        uint64_t cacheKey;
+        bool fromCache;
+        BVHBuildStatistics statistics;
+    };
+
+    struct MeshTransformation
+    {
+        Mesh* mesh;
+        Vector3 position, rotation;
+        float scale;
+    };
 
     TextureLoader textureLoader;
     MeshLoader meshLoader;
+    BVHCache hierarchyCache;
+    Tokenizer tokenizer;
+    std::unordered_map<std::string, std::shared_ptr<MeshData>> meshesData;
+    BVHBuildOptions hierarchyOptions;
+    std::string directoryPath;
+    std::vector<TextureJob> textureJobs;
+    std::vector<MeshJob> meshJobs;
+    std::vector<MeshTransformation> meshTransformations;
 
     bool IsEmptyLine(const char* line);
     bool ParseFloat(float& value);
@@ -28,14 +77,27 @@ private:
     bool ParsePlane(FILE* file, Plane* plane, uint32_t& lineNumber, char* line, char* token);
     bool ParseDisk(FILE* file, Disk* disk, uint32_t& lineNumber, char* line, char* token);
     bool ParseTriangle(FILE* file, Triangle* triangle, uint32_t& lineNumber, char* line, char* token);
-    bool ParseMesh(FILE* file, Mesh* mesh, uint32_t& lineNumber, char* line, char* token, const std::string& directoryPath);
+    bool ParseMesh(FILE* file, Mesh* mesh, uint32_t& lineNumber, char* line, char* token);
     bool ParseLight(FILE* file, Light* light, uint32_t& lineNumber, char* line, char* token);
-    bool ParseTexture(FILE* file, Scene* scene, uint32_t& lineNumber, char* line, char* token, const std::string& directoryPath);
-    bool ParseFile(FILE* file, Scene* scene, const std::string& directoryPath);
+    bool ParseTexture(FILE* file, Scene* scene, uint32_t& lineNumber, char* line, char* token);
+    bool ParseFile(FILE* file, Scene* scene);
+    bool LoadTexture(const TextureJob& job, Scene* scene);
+    bool LoadMesh(MeshJob& job);
+    void BuildMesh(MeshJob& job, uint32_t threadsCount);
+    /*
+        Cost of the hierarchy or mipmap a loaded job still needs, zero when it needs neither.
+    */
+    uint64_t GetBuildCost(uint32_t job, const Scene* scene) const;
+    bool RunJobs(Scene* scene);
     std::string GetDirectoryPath(const char* path) const;
 
 public:
-    bool LoadScene(const char* path, Scene* scene);
+    SceneLoader();
+
+    /*
+        acceleratorType overrides the accelerator selected in the scene file when not null.
+    */
+    bool LoadScene(const char* path, Scene* scene, const BVHBuildOptions& hierarchyOptions = BVHBuildOptions(), const AcceleratorType* acceleratorType = nullptr);
 };
 
 #endif
\ No newline at end of file
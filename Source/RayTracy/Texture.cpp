@@ -1,6 +1,16 @@
 #include "Texture.h"
 #include <utility>
 #include <math.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SSE
+#include <emmintrin.h>
+#endif
+
+const uint32_t Texture::ParallelThreshold = 1 << 18;
 
 Texture::Texture(uint32_t width, uint32_t height, uint32_t bytesPerPixel, bool mipmap) :
     width(width),
@@ -105,24 +115,6 @@ uint8_t* Texture::GetData() const
     return data;
 }
 
-Vector4 Texture::Interpolate(uint32_t offset, uint32_t x, uint32_t y, uint32_t previousWidth) const
-{
-    Vector4 sum{ 0, 0, 0 , 0 };
-    for (uint32_t dx = 0; dx < 2; dx++) {
-        for (uint32_t dy = 0; dy < 2; dy++) {
-            uint32_t index = offset + (previousWidth * (y * 2 + dy) + (x * 2 + dx)) * bytesPerPixel;
-            Vector4 color {
-                Normalize(data[index]),
-                Normalize(data[index + 1]),
-                Normalize(data[index + 2])
-            };
-            color.w = bytesPerPixel == 4 ? Normalize(data[index + 3]) : 1;
-            sum = sum + color;
-        }
-    }
-    return sum * 0.25;
-}
-
 Vector4 Texture::GetPixel(uint32_t index) const
 {
     Vector4 color{
@@ -134,33 +126,89 @@ Vector4 Texture::GetPixel(uint32_t index) const
     return color;
 }
 
-bool Texture::GenerateMipmap()
+void Texture::DownsampleRows(uint32_t previousOffset, uint32_t previousWidth, uint32_t levelOffset, uint32_t levelWidth, uint32_t beginRow, uint32_t endRow)
+{
+    // An odd last column of the previous level is dropped, like the odd last row.
+    uint32_t rowSize = 2 * levelWidth * bytesPerPixel;
+    std::vector<uint16_t> sums(rowSize);
+    for (uint32_t y = beginRow; y < endRow; y++) {
+        const uint8_t* row0 = data + previousOffset + 2 * y * previousWidth * bytesPerPixel;
+        const uint8_t* row1 = row0 + previousWidth * bytesPerPixel;
+        uint8_t* output = data + levelOffset + y * levelWidth * bytesPerPixel;
+
+        uint32_t i = 0;
+#ifdef TEXTURE_SSE
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= rowSize; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+            _mm_storeu_si128((__m128i*)(sums.data() + i), _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+            _mm_storeu_si128((__m128i*)(sums.data() + i + 8), _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+        }
+#endif
+        for (; i < rowSize; i++) {
+            sums[i] = row0[i] + row1[i];
+        }
+
+        uint32_t x = 0;
+#ifdef TEXTURE_SSE
+        // Every register holds the column sums of two source texels, four output texels per step.
+        if (bytesPerPixel == 4) {
+            __m128i rounding = _mm_set1_epi16(2);
+            for (; x + 4 <= levelWidth; x += 4) {
+                const uint16_t* source = sums.data() + 8 * x;
+                __m128i pair0 = _mm_loadu_si128((const __m128i*)source);
+                __m128i pair1 = _mm_loadu_si128((const __m128i*)(source + 8));
+                __m128i pair2 = _mm_loadu_si128((const __m128i*)(source + 16));
+                __m128i pair3 = _mm_loadu_si128((const __m128i*)(source + 24));
+                pair0 = _mm_add_epi16(pair0, _mm_srli_si128(pair0, 8));
+                pair1 = _mm_add_epi16(pair1, _mm_srli_si128(pair1, 8));
+                pair2 = _mm_add_epi16(pair2, _mm_srli_si128(pair2, 8));
+                pair3 = _mm_add_epi16(pair3, _mm_srli_si128(pair3, 8));
+                __m128i texels01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(pair0, pair1), rounding), 2);
+                __m128i texels23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(pair2, pair3), rounding), 2);
+                _mm_storeu_si128((__m128i*)(output + 4 * x), _mm_packus_epi16(texels01, texels23));
+            }
+        }
+#endif
+        for (uint32_t c = x * bytesPerPixel; c < levelWidth * bytesPerPixel; c++) {
+            uint32_t texel = c / bytesPerPixel, channel = c - texel * bytesPerPixel;
+            uint32_t index = 2 * texel * bytesPerPixel + channel;
+            output[c] = (sums[index] + sums[index + bytesPerPixel] + 2) >> 2;
+        }
+    }
+}
+
+bool Texture::GenerateMipmap(uint32_t threadsCount)
 {
     if (!mipmap) {
         return false;
     }
-    uint32_t levelWidth = width, levelHeight = height, previousWidth = width;
-    uint32_t previousOffset = 0, levelOffset = 0;
+    uint32_t levelWidth = width, levelHeight = height;
+    uint32_t levelOffset = 0;
+    if (threadsCount == 0) {
+        threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    }
     while (levelWidth >= 2 && levelHeight >= 2) {
+        uint32_t previousOffset = levelOffset, previousWidth = levelWidth;
         levelOffset += levelWidth * levelHeight * bytesPerPixel;
         levelWidth /= 2;
         levelHeight /= 2;
 
-        uint32_t index = levelOffset;
-        for (uint32_t y = 0; y < levelHeight; y++) {
-            for (uint32_t x = 0; x < levelWidth; x++) {
-                auto color = Interpolate(previousOffset, x, y, previousWidth);
-                data[index] = color.x * 255;
-                data[index + 1] = color.y * 255;
-                data[index + 2] = color.z * 255;
-                if (bytesPerPixel == 4) {
-                    data[index + 3] = color.w * 255;
-                }
-                index += bytesPerPixel;
-            }
+        uint32_t levelThreadsCount = 1;
+        if (levelWidth * levelHeight >= ParallelThreshold) {
+            levelThreadsCount = std::min(threadsCount, levelHeight);
         }
 
-        previousWidth = levelWidth;
+        std::vector<std::thread> threads;
+        for (uint32_t i = 1; i < levelThreadsCount; i++) {
+            threads.push_back(std::thread(&Texture::DownsampleRows, this, previousOffset, previousWidth, levelOffset, levelWidth,
+                levelHeight * i / levelThreadsCount, levelHeight * (i + 1) / levelThreadsCount));
+        }
+        DownsampleRows(previousOffset, previousWidth, levelOffset, levelWidth, 0, levelHeight / levelThreadsCount);
+        for (auto& thread : threads) {
+            thread.join();
+        }
     }
 
     return true;
@@ -7,12 +7,18 @@
 class Texture
 {
 private:
+    static const uint32_t ParallelThreshold;
+
     uint8_t* data;
     uint32_t width, height, bytesPerPixel;
     bool mipmap;
     uint32_t GetCoordinate(float value, uint32_t range) const;
     float Normalize(uint8_t value) const;
-    Vector4 Interpolate(uint32_t offset, uint32_t x, uint32_t y, uint32_t previousWidth) const;
+    /*
+        Writes rows [beginRow, endRow) of a mipmap level as the rounded average of 2x2 texels of
+        the previous level. Source rows are summed with SIMD, 4 byte texels are also paired with it.
+    */
+    void DownsampleRows(uint32_t previousOffset, uint32_t previousWidth, uint32_t levelOffset, uint32_t levelWidth, uint32_t beginRow, uint32_t endRow);
     Vector4 GetPixel(uint32_t index) const;
 
 public:
@@ -30,7 +36,11 @@ public:
 
     uint8_t* GetData() const;
 
-    bool GenerateMipmap();
+    /*
+        Levels with at least ParallelThreshold texels are split into row ranges on threadsCount
+        threads, zero uses one thread per hardware thread.
+    */
+    bool GenerateMipmap(uint32_t threadsCount = 0);
     bool HasMipmap() const;
     uint32_t GetWidth() const;
     uint32_t GetHeight() const;
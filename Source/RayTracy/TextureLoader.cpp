@@ -9,6 +9,20 @@ void ReadImageFileChunk(png_structp pngPtr, png_bytep outBytes, png_size_t byteC
     fread(outBytes, byteCountToRead, 1, *file);
 }
 
+void WriteImageFileChunk(png_structp pngPtr, png_bytep bytes, png_size_t byteCountToWrite)
+{
+    auto file = (FILE**)png_get_io_ptr(pngPtr);
+    if (fwrite(bytes, byteCountToWrite, 1, *file) != 1) {
+        png_error(pngPtr, "Write error");
+    }
+}
+
+void FlushImageFile(png_structp pngPtr)
+{
+    auto file = (FILE**)png_get_io_ptr(pngPtr);
+    fflush(*file);
+}
+
 Texture TextureLoader::LoadTexture(const std::string& directoryPath, const std::string& path, bool mipmap)
 {
     Texture empty(0, 0, 0);
@@ -62,3 +76,39 @@ Texture TextureLoader::LoadTexture(const std::string& directoryPath, const std::
     fclose(file);
     return texture;
 }
+
+bool TextureLoader::SaveImage(const std::string& path, const uint8_t* buffer, uint32_t width, uint32_t height)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    auto pngPtr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!pngPtr) {
+        fclose(file);
+        return false;
+    }
+
+    auto pngInfo = png_create_info_struct(pngPtr);
+    if (!pngInfo || setjmp(png_jmpbuf(pngPtr))) {
+        png_destroy_write_struct(&pngPtr, pngInfo ? &pngInfo : NULL);
+        fclose(file);
+        return false;
+    }
+
+    png_set_write_fn(pngPtr, &file, WriteImageFileChunk, FlushImageFile);
+    png_set_IHDR(pngPtr, pngInfo, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(pngPtr, pngInfo);
+    // The fourth byte of every pixel is dropped.
+    png_set_bgr(pngPtr);
+    png_set_filler(pngPtr, 0, PNG_FILLER_AFTER);
+
+    for (uint32_t rowIndex = 0; rowIndex < height; rowIndex++) {
+        png_write_row(pngPtr, (png_bytep)(buffer + 4 * width * rowIndex));
+    }
+    png_write_end(pngPtr, NULL);
+
+    png_destroy_write_struct(&pngPtr, &pngInfo);
+    return fclose(file) == 0;
+}
@@ -9,6 +9,10 @@ class TextureLoader
 private:
 public:
     Texture LoadTexture(const std::string& directoryPath, const std::string& path, bool mipmap);
+    /*
+        Writes a rendered frame, 4 bytes per pixel in blue, green, red order, as an RGB PNG.
+    */
+    bool SaveImage(const std::string& path, const uint8_t* buffer, uint32_t width, uint32_t height);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool() :
+    function(nullptr),
+    runningThreads(0),
+    job(0),
+    stopping(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    Stop();
+}
+
+void ThreadPool::Start(uint32_t threadsCount)
+{
+    Stop();
+
+    if (threadsCount == 0) {
+        threadsCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t i = 0; i < threadsCount; i++) {
+        queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+    }
+    for (uint32_t i = 1; i < threadsCount; i++) {
+        threads.push_back(std::thread(&ThreadPool::Worker, this, i, job));
+    }
+}
+
+void ThreadPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCondition.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    queues.clear();
+    stopping = false;
+}
+
+uint32_t ThreadPool::GetThreadsCount() const
+{
+    return threads.size() + 1;
+}
+
+void ThreadPool::Run(uint32_t tasksCount, const TaskFunction& function)
+{
+    std::vector<uint32_t> tasks(tasksCount);
+    for (uint32_t i = 0; i < tasksCount; i++) {
+        tasks[i] = i;
+    }
+    Run(tasks, function);
+}
+
+void ThreadPool::Run(const std::vector<uint32_t>& tasks, const TaskFunction& function)
+{
+    if (threads.empty()) {
+        for (auto task : tasks) {
+            function(task, 0);
+        }
+        return;
+    }
+
+    // Workers only look at the queues after they see the new job under the mutex.
+    for (uint32_t i = 0; i < tasks.size(); i++) {
+        queues[i % queues.size()]->tasks.push_back(tasks[i]);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->function = &function;
+        runningThreads = threads.size();
+        job++;
+    }
+    startCondition.notify_all();
+
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finishCondition.wait(lock, [this] { return runningThreads == 0; });
+    this->function = nullptr;
+}
+
+void ThreadPool::Worker(uint32_t thread, uint64_t finishedJob)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        startCondition.wait(lock, [&] { return stopping || job != finishedJob; });
+        if (stopping) {
+            return;
+        }
+        finishedJob = job;
+
+        lock.unlock();
+        RunTasks(thread);
+        lock.lock();
+
+        if (--runningThreads == 0) {
+            finishCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::RunTasks(uint32_t thread)
+{
+    uint32_t task;
+    while (PopTask(thread, &task)) {
+        (*function)(task, thread);
+    }
+}
+
+bool ThreadPool::PopTask(uint32_t thread, uint32_t* task)
+{
+    {
+        auto& queue = *queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            *task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // No task is added during a job, so once every queue was seen empty this thread is done.
+    for (uint32_t i = 1; i < queues.size(); i++) {
+        auto& queue = *queues[(thread + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            *task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <memory>
+
+/*
+    Persistent worker threads for frame sized jobs. The threads sleep between jobs, so they are
+    created once instead of for every frame.
+
+    Run deals the tasks round robin into one deque per thread, the calling thread included.
+    Each thread takes its own tasks from the front and, when it runs out, steals from the back
+    of the other deques. Tasks ordered from the most to the least expensive start the long ones
+    first on every thread and leave the cheap ones for balancing the end of the job.
+*/
+class ThreadPool
+{
+public:
+    typedef std::function<void(uint32_t task, uint32_t thread)> TaskFunction;
+
+private:
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::mutex mutex;
+    std::condition_variable startCondition, finishCondition;
+
+    const TaskFunction* function;
+    uint32_t runningThreads;
+    uint64_t job;
+    bool stopping;
+
+    void Worker(uint32_t thread, uint64_t finishedJob);
+    void RunTasks(uint32_t thread);
+    bool PopTask(uint32_t thread, uint32_t* task);
+
+public:
+    ThreadPool();
+    ~ThreadPool();
+
+    /*
+        Restarts the pool with threadsCount threads including the caller of Run, zero uses one
+        thread per hardware thread.
+    */
+    void Start(uint32_t threadsCount);
+    void Stop();
+
+    uint32_t GetThreadsCount() const;
+    /*
+        Calls function for every task in [0, tasksCount). Thread indices are below GetThreadsCount,
+        the calling thread is thread 0.
+    */
+    void Run(uint32_t tasksCount, const TaskFunction& function);
+    /*
+        Same as above for the listed tasks, which are started roughly in the given order.
+    */
+    void Run(const std::vector<uint32_t>& tasks, const TaskFunction& function);
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#include "Tokenizer.h"
+#include <string.h>
+
+Tokenizer::Tokenizer(const char* delimiters) :
+    delimiters(delimiters),
+    position(nullptr)
+{
+}
+
+bool Tokenizer::IsDelimiter(char c) const
+{
+    return strchr(delimiters, c) != nullptr;
+}
+
+char* Tokenizer::First(char* line)
+{
+    position = line;
+    return Next();
+}
+
+char* Tokenizer::Next()
+{
+    if (!position) {
+        return nullptr;
+    }
+    while (*position != '\0' && IsDelimiter(*position)) {
+        position++;
+    }
+    if (*position == '\0') {
+        position = nullptr;
+        return nullptr;
+    }
+
+    auto token = position;
+    while (*position != '\0' && !IsDelimiter(*position)) {
+        position++;
+    }
+    if (*position != '\0') {
+        *position++ = '\0';
+    }
+    return token;
+}
@@ -0,0 +1,27 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+/*
+    Reentrant replacement for strtok. The position in the line is kept in the tokenizer instead
+    of a global, so loaders on different threads do not interfere.
+*/
+class Tokenizer
+{
+private:
+    const char* delimiters;
+    char* position;
+
+    bool IsDelimiter(char c) const;
+
+public:
+    Tokenizer(const char* delimiters);
+
+    /*
+        Starts tokenizing line, which is modified in place like with strtok. Returns the first
+        token or null when the line has none.
+    */
+    char* First(char* line);
+    char* Next();
+};
+
+#endif
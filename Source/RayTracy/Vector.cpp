@@ -6,7 +6,7 @@ Vector2::Vector2(float x, float y) :
 {
 }
 
-float Vector2::GetLength()
+float Vector2::GetLength() const
 {
     return sqrtf(x * x + y * y);
 }
@@ -18,34 +18,28 @@ void Vector2::Normalize()
     y /= length;
 }
 
-Vector2 Vector2::operator * (float multiplier)
+Vector2 Vector2::operator * (float multiplier) const
 {
     return Vector2{ x * multiplier, y * multiplier };
 }
 
-Vector2 Vector2::operator + (Vector2 other)
+Vector2 Vector2::operator + (Vector2 other) const
 {
     return Vector2{ x + other.x, y + other.y };
 }
 
-Vector2 Vector2::operator - (Vector2 other)
+Vector2 Vector2::operator - (Vector2 other) const
 {
     return Vector2{ x - other.x, y - other.y };
 }
 
-bool Vector2::operator==(const Vector2 & other)
+bool Vector2::operator==(const Vector2 & other) const
 {
     return x == other.x && y == other.y;
 }
 
-Vector3::Vector3(float x, float y, float z) : 
-    x(x), 
-    y(y), 
-    z(z)
-{
-}
 
-float Vector3::GetLength()
+float Vector3::GetLength() const
 {
     return sqrtf(x * x + y * y + z * z);
 }
@@ -58,27 +52,27 @@ void Vector3::Normalize()
     z /= length;
 }
 
-Vector3 Vector3::operator * (float multiplier)
+Vector3 Vector3::operator * (float multiplier) const
 {
     return Vector3{ x * multiplier, y * multiplier, z * multiplier };
 }
 
-Vector3 Vector3::operator + (Vector3 other)
+Vector3 Vector3::operator + (Vector3 other) const
 {
     return Vector3{ x + other.x, y + other.y, z + other.z };
 }
 
-Vector3 Vector3::operator - (Vector3 other)
+Vector3 Vector3::operator - (Vector3 other) const
 {
     return Vector3{ x - other.x, y - other.y, z - other.z };
 }
 
-bool Vector3::operator==(const Vector3 & other)
+bool Vector3::operator==(const Vector3 & other) const
 {
     return x == other.x && y == other.y && z == other.z;
 }
 
-float Vector4::GetLength()
+float Vector4::GetLength() const
 {
     return sqrtf(x * x + y * y + z * z + w * w);
 }
@@ -92,27 +86,27 @@ void Vector4::Normalize()
     w /= length;
 }
 
-Vector3 Vector4::ToVector3()
+Vector3 Vector4::ToVector3() const
 {
     return Vector3{ x, y, z };
 }
 
-Vector4 Vector4::operator * (float multiplier)
+Vector4 Vector4::operator * (float multiplier) const
 {
     return Vector4{ x * multiplier, y * multiplier, z * multiplier, w * multiplier };
 }
 
-Vector4 Vector4::operator + (Vector4 other)
+Vector4 Vector4::operator + (Vector4 other) const
 {
     return Vector4{ x + other.x, y + other.y, z + other.z, w + other.w };
 }
 
-Vector4 Vector4::operator - (Vector4 other)
+Vector4 Vector4::operator - (Vector4 other) const
 {
     return Vector4{ x - other.x, y - other.y, z - other.z, w - other.w };
 }
 
-bool Vector4::operator==(const Vector4 & other)
+bool Vector4::operator==(const Vector4 & other) const
 {
     return x == other.x && y == other.y && z == other.z && w == other.w;
 }
@@ -10,12 +10,12 @@ struct Vector2
 
     Vector2(float x = 0, float y = 0);
 
-    float GetLength();
+    float GetLength() const;
     void Normalize();
-    Vector2 operator * (float multiplier);
-    Vector2 operator + (Vector2 other);
-    Vector2 operator - (Vector2 other);
-    bool operator == (const Vector2& other);
+    Vector2 operator * (float multiplier) const;
+    Vector2 operator + (Vector2 other) const;
+    Vector2 operator - (Vector2 other) const;
+    bool operator == (const Vector2& other) const;
 };
 
 struct Vector3
@@ -24,14 +24,14 @@ struct Vector3
     float y;
     float z;
 
-    Vector3(float x = 0, float y = 0, float z = 0);
+    inline Vector3(float x = 0, float y = 0, float z = 0) : x(x), y(y), z(z) {}
 
-    float GetLength();
+    float GetLength() const;
     void Normalize();
-    Vector3 operator * (float multiplier);
-    Vector3 operator + (Vector3 other);
-    Vector3 operator - (Vector3 other);
-    bool operator == (const Vector3& other);
+    Vector3 operator * (float multiplier) const;
+    Vector3 operator + (Vector3 other) const;
+    Vector3 operator - (Vector3 other) const;
+    bool operator == (const Vector3& other) const;
 };
 
 struct Vector4
@@ -41,13 +41,13 @@ struct Vector4
     float z;
     float w;
 
-    float GetLength();
+    float GetLength() const;
     void Normalize();
-    Vector3 ToVector3();
-    Vector4 operator * (float multiplier);
-    Vector4 operator + (Vector4 other);
-    Vector4 operator - (Vector4 other);
-    bool operator == (const Vector4& other);
+    Vector3 ToVector3() const;
+    Vector4 operator * (float multiplier) const;
+    Vector4 operator + (Vector4 other) const;
+    Vector4 operator - (Vector4 other) const;
+    bool operator == (const Vector4& other) const;
 };
 
 float Dot(Vector3 a, Vector3 b);
@@ -0,0 +1,212 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "BoundingBox.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WIDE_BVH_SSE
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define WIDE_BVH_AVX
+#endif
+
+/*
+    Node of a 4 or 8-ary BVH. Child boxes are stored as structure of arrays so that all of them
+    can be tested against a ray with a few SIMD instructions. A child with a non-zero count is a leaf
+    referencing count primitives starting at child; otherwise child is the index of a wide node.
+*/
+template<uint32_t Width>
+struct WideBVHNode
+{
+    static const uint32_t Arity = Width;
+
+    float minX[Width], minY[Width], minZ[Width];
+    float maxX[Width], maxY[Width], maxZ[Width];
+    uint32_t children[Width];
+    uint32_t counts[Width];
+    uint32_t childrenCount;
+};
+
+/*
+    80 byte 8-ary node. Child boxes are quantized to 8 bits per plane on a grid anchored at origin,
+    with a power of two cell size per axis. Inner children are stored consecutively from childBase,
+    primitives of leaf children consecutively from primitiveBase in child order.
+*/
+struct CompressedBVHNode
+{
+    static const uint32_t Arity = 8;
+
+    float origin[3];
+    int8_t exponents[3];
+    uint8_t childrenCount;
+    uint32_t childBase;
+    uint32_t primitiveBase;
+    uint8_t counts[8];
+    uint8_t minX[8], minY[8], minZ[8];
+    uint8_t maxX[8], maxY[8], maxZ[8];
+};
+
+template<uint32_t Width>
+inline void GetChildren(const WideBVHNode<Width>& node, uint32_t* children, uint32_t* counts)
+{
+    for (uint32_t i = 0; i < Width; i++) {
+        children[i] = node.children[i];
+        counts[i] = node.counts[i];
+    }
+}
+
+inline void GetChildren(const CompressedBVHNode& node, uint32_t* children, uint32_t* counts)
+{
+    uint32_t child = node.childBase, primitive = node.primitiveBase;
+    for (uint32_t i = 0; i < node.childrenCount; i++) {
+        counts[i] = node.counts[i];
+        if (counts[i] > 0) {
+            children[i] = primitive;
+            primitive += counts[i];
+        }
+        else {
+            children[i] = child++;
+        }
+    }
+}
+
+inline float GetScale(int8_t exponent)
+{
+    uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+/*
+    Tests the ray against every child box of the node. Returns a bit mask of the children hit
+    before maxDistance and writes entry distances for them.
+*/
+template<uint32_t Width>
+inline uint32_t IntersectChildren(const WideBVHNode<Width>& node, const Vector3& origin, const Vector3& inverseDirection, float maxDistance, float* distances)
+{
+    uint32_t mask = 0;
+
+#ifdef WIDE_BVH_SSE
+    __m128 originX = _mm_set1_ps(origin.x), originY = _mm_set1_ps(origin.y), originZ = _mm_set1_ps(origin.z);
+    __m128 inverseX = _mm_set1_ps(inverseDirection.x), inverseY = _mm_set1_ps(inverseDirection.y), inverseZ = _mm_set1_ps(inverseDirection.z);
+    __m128 zero = _mm_setzero_ps(), limit = _mm_set1_ps(maxDistance);
+
+    for (uint32_t i = 0; i < Width; i += 4) {
+        __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX + i), originX), inverseX);
+        __m128 x2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX + i), originX), inverseX);
+        __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY + i), originY), inverseY);
+        __m128 y2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY + i), originY), inverseY);
+        __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ + i), originZ), inverseZ);
+        __m128 z2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ + i), originZ), inverseZ);
+
+        __m128 entryDistance = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_max_ps(_mm_min_ps(z1, z2), zero));
+        __m128 exitDistance = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_min_ps(_mm_max_ps(z1, z2), limit));
+
+        _mm_storeu_ps(distances + i, entryDistance);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(entryDistance, exitDistance)) << i;
+    }
+#else
+    for (uint32_t i = 0; i < Width; i++) {
+        float x1 = (node.minX[i] - origin.x) * inverseDirection.x;
+        float x2 = (node.maxX[i] - origin.x) * inverseDirection.x;
+        float y1 = (node.minY[i] - origin.y) * inverseDirection.y;
+        float y2 = (node.maxY[i] - origin.y) * inverseDirection.y;
+        float z1 = (node.minZ[i] - origin.z) * inverseDirection.z;
+        float z2 = (node.maxZ[i] - origin.z) * inverseDirection.z;
+
+        float entryDistance = Max(Max(Min(x1, x2), Min(y1, y2)), Max(Min(z1, z2), 0.0f));
+        float exitDistance = Min(Min(Max(x1, x2), Max(y1, y2)), Min(Max(z1, z2), maxDistance));
+
+        distances[i] = entryDistance;
+        mask |= (entryDistance <= exitDistance ? 1u : 0u) << i;
+    }
+#endif
+
+    return mask & ((1u << node.childrenCount) - 1);
+}
+
+inline uint32_t IntersectChildren(const CompressedBVHNode& node, const Vector3& origin, const Vector3& inverseDirection, float maxDistance, float* distances)
+{
+    float scaleX = GetScale(node.exponents[0]), scaleY = GetScale(node.exponents[1]), scaleZ = GetScale(node.exponents[2]);
+    float offsetX = node.origin[0] - origin.x, offsetY = node.origin[1] - origin.y, offsetZ = node.origin[2] - origin.z;
+    uint32_t mask = 0;
+
+#ifdef WIDE_BVH_SSE
+    __m128 zero = _mm_setzero_ps(), limit = _mm_set1_ps(maxDistance);
+    __m128i zeroBytes = _mm_setzero_si128();
+    __m128 multiplierX = _mm_set1_ps(scaleX), multiplierY = _mm_set1_ps(scaleY), multiplierZ = _mm_set1_ps(scaleZ);
+    __m128 addendX = _mm_set1_ps(offsetX), addendY = _mm_set1_ps(offsetY), addendZ = _mm_set1_ps(offsetZ);
+    __m128 inverseX = _mm_set1_ps(inverseDirection.x), inverseY = _mm_set1_ps(inverseDirection.y), inverseZ = _mm_set1_ps(inverseDirection.z);
+
+    // Planes are decoded relative to the ray origin before the division so that axis parallel
+    // rays give infinities rather than 0 * inf.
+    auto decode = [&](const uint8_t* values, __m128 multiplier, __m128 addend, __m128 inverse) {
+        int32_t packed;
+        memcpy(&packed, values, sizeof(packed));
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zeroBytes);
+        __m128 quantized = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zeroBytes));
+        return _mm_mul_ps(_mm_add_ps(_mm_mul_ps(quantized, multiplier), addend), inverse);
+    };
+
+    for (uint32_t i = 0; i < 8; i += 4) {
+        __m128 x1 = decode(node.minX + i, multiplierX, addendX, inverseX);
+        __m128 x2 = decode(node.maxX + i, multiplierX, addendX, inverseX);
+        __m128 y1 = decode(node.minY + i, multiplierY, addendY, inverseY);
+        __m128 y2 = decode(node.maxY + i, multiplierY, addendY, inverseY);
+        __m128 z1 = decode(node.minZ + i, multiplierZ, addendZ, inverseZ);
+        __m128 z2 = decode(node.maxZ + i, multiplierZ, addendZ, inverseZ);
+
+        __m128 entryDistance = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_max_ps(_mm_min_ps(z1, z2), zero));
+        __m128 exitDistance = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_min_ps(_mm_max_ps(z1, z2), limit));
+
+        _mm_storeu_ps(distances + i, entryDistance);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(entryDistance, exitDistance)) << i;
+    }
+#else
+    for (uint32_t i = 0; i < 8; i++) {
+        float x1 = (node.minX[i] * scaleX + offsetX) * inverseDirection.x;
+        float x2 = (node.maxX[i] * scaleX + offsetX) * inverseDirection.x;
+        float y1 = (node.minY[i] * scaleY + offsetY) * inverseDirection.y;
+        float y2 = (node.maxY[i] * scaleY + offsetY) * inverseDirection.y;
+        float z1 = (node.minZ[i] * scaleZ + offsetZ) * inverseDirection.z;
+        float z2 = (node.maxZ[i] * scaleZ + offsetZ) * inverseDirection.z;
+
+        float entryDistance = Max(Max(Min(x1, x2), Min(y1, y2)), Max(Min(z1, z2), 0.0f));
+        float exitDistance = Min(Min(Max(x1, x2), Max(y1, y2)), Min(Max(z1, z2), maxDistance));
+
+        distances[i] = entryDistance;
+        mask |= (entryDistance <= exitDistance ? 1u : 0u) << i;
+    }
+#endif
+
+    return mask & ((1u << node.childrenCount) - 1);
+}
+
+#ifdef WIDE_BVH_AVX
+inline uint32_t IntersectChildren(const WideBVHNode<8>& node, const Vector3& origin, const Vector3& inverseDirection, float maxDistance, float* distances)
+{
+    __m256 originX = _mm256_set1_ps(origin.x), originY = _mm256_set1_ps(origin.y), originZ = _mm256_set1_ps(origin.z);
+    __m256 inverseX = _mm256_set1_ps(inverseDirection.x), inverseY = _mm256_set1_ps(inverseDirection.y), inverseZ = _mm256_set1_ps(inverseDirection.z);
+
+    __m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minX), originX), inverseX);
+    __m256 x2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxX), originX), inverseX);
+    __m256 y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minY), originY), inverseY);
+    __m256 y2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxY), originY), inverseY);
+    __m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.minZ), originZ), inverseZ);
+    __m256 z2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.maxZ), originZ), inverseZ);
+
+    __m256 entryDistance = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x1, x2), _mm256_min_ps(y1, y2)), _mm256_max_ps(_mm256_min_ps(z1, z2), _mm256_setzero_ps()));
+    __m256 exitDistance = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x1, x2), _mm256_max_ps(y1, y2)), _mm256_min_ps(_mm256_max_ps(z1, z2), _mm256_set1_ps(maxDistance)));
+
+    _mm256_storeu_ps(distances, entryDistance);
+    uint32_t mask = _mm256_movemask_ps(_mm256_cmp_ps(entryDistance, exitDistance, _CMP_LE_OQ));
+    return mask & ((1u << node.childrenCount) - 1);
+}
+#endif
+
+#endif
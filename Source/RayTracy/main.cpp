@@ -75,6 +75,12 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (renderer.IsBenchmark()) {
+        renderer.RunBenchmark();
+        renderer.CleanUp();
+        return 0;
+    }
+
     WNDCLASS windowClass;
     memset(&windowClass, 0, sizeof(windowClass));
     windowClass.lpszClassName = "Window";
@@ -103,14 +109,44 @@ int main(int argc, char** argv)
 
 #else
 
+#ifdef ENABLE_LOCAL_SOCKETS
+#include "RenderFarm.h"
+#include "RenderServer.h"
+#endif
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
 
-uint32_t width, height;
-uint8_t* buffer;
-XImage* image;
+struct Frame
+{
+    std::vector<uint8_t> pixels;
+    uint32_t width, height;
+};
+
+/*
+    The render thread draws into frames[1 - presentedFrame] while the main thread presents
+    frames[presentedFrame] and handles window events. A finished frame is swapped under the mutex
+    and announced through wakeupPipe, which the main thread waits on together with the X connection.
+    A resize or closing the window cancels the pass in flight through cancelFrame, so the
+    render thread starts over at the new size after the tiles it is working on.
+*/
 Display* display;
 Window window;
+std::mutex mutex;
+std::condition_variable condition;
+Frame frames[2];
+int presentedFrame;
+uint32_t width, height;
+bool isRunning, isConverged;
+CancellationToken cancelFrame;
+int wakeupPipe[2];
 
 void GetWindowSize(Display* display, Window window, uint32_t* width, uint32_t* height)
 {
@@ -120,26 +156,114 @@ void GetWindowSize(Display* display, Window window, uint32_t* width, uint32_t* h
     XGetGeometry(display, window, &w, &x, &y, width, height, &borderWidth, &depth);
 }
 
-void CreateBuffer()
+void RenderFrames(Renderer* renderer)
 {
-    GetWindowSize(display, window, &width, &height);
-    uint32_t bufferLength = width * height * 4;
-    buffer = new uint8_t[bufferLength];
-    auto visual = DefaultVisual(display, 0);
-    image = XCreateImage(display, visual, 24, ZPixmap, 0, (char*)buffer, width, height, 8 * 4, 0);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        condition.wait(lock, [] { return !isRunning || !isConverged; });
+        if (!isRunning) {
+            return;
+        }
+
+        auto& frame = frames[1 - presentedFrame];
+        frame.width = width;
+        frame.height = height;
+        cancelFrame = false;
+        lock.unlock();
+
+        frame.pixels.resize(frame.width * frame.height * 4);
+        bool isRendered = renderer->RenderProgressive(frame.pixels.data(), frame.width, frame.height, &cancelFrame);
+
+        lock.lock();
+        if (cancelFrame) {
+            continue;
+        }
+        if (isRendered) {
+            presentedFrame = 1 - presentedFrame;
+            // The write end does not block, a full pipe already wakes up the main thread.
+            char message = 0;
+            if (write(wakeupPipe[1], &message, 1) < 0) {
+                continue;
+            }
+        }
+        // The image converged for the frame size, a resize in the meantime needs new passes.
+        else if (frame.width == width && frame.height == height) {
+            isConverged = true;
+        }
+    }
 }
 
-void DestroyBuffer()
+void PresentFrame()
 {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& frame = frames[presentedFrame];
+    if (frame.pixels.empty()) {
+        return;
+    }
+
+    auto visual = DefaultVisual(display, 0);
+    auto image = XCreateImage(display, visual, 24, ZPixmap, 0, (char*)frame.pixels.data(), frame.width, frame.height, 8 * 4, 0);
+    XPutImage(display, window, DefaultGC(display, 0), image, 0, 0, 0, 0, frame.width, frame.height);
+    // The pixels belong to the frame, XDestroyImage would free them.
+    image->data = nullptr;
     XDestroyImage(image);
+    XFlush(display);
 }
 
 int main(int argc, char** argv)
 {
+#ifdef ENABLE_LOCAL_SOCKETS
+    RenderServer server;
+    std::vector<char*> serverArguments;
+    if (!server.ParseArguments(argc, argv, &serverArguments)) {
+        return -1;
+    }
+    if (server.IsClient()) {
+        return server.SendRequest() ? 0 : -1;
+    }
+
+    RenderFarm farm;
+    std::vector<char*> arguments;
+    if (!farm.ParseArguments(serverArguments.size(), serverArguments.data(), &arguments)) {
+        return -1;
+    }
+    if (server.IsServer() && (farm.IsCoordinator() || farm.IsWorker())) {
+        printf("The render server cannot be part of a farm.\n");
+        return -1;
+    }
+    if (farm.IsCoordinator()) {
+        return farm.Coordinate(arguments) ? 0 : -1;
+    }
+    bool hasScene = !server.IsServer();
+#else
+    std::vector<char*> arguments(argv, argv + argc);
+    bool hasScene = true;
+#endif
+
     Renderer renderer;
-    if (!renderer.Initialize(argc, argv)) {
+    if (!renderer.Initialize(arguments.size(), arguments.data(), hasScene)) {
         return -1;
     }
+
+#ifdef ENABLE_LOCAL_SOCKETS
+    if (server.IsServer()) {
+        bool isServed = server.Serve(&renderer);
+        renderer.CleanUp();
+        return isServed ? 0 : -1;
+    }
+
+    if (farm.IsWorker()) {
+        bool isWorking = farm.Work(&renderer);
+        renderer.CleanUp();
+        return isWorking ? 0 : -1;
+    }
+#endif
+
+    if (renderer.IsBenchmark()) {
+        renderer.RunBenchmark();
+        renderer.CleanUp();
+        return 0;
+    }
     display = XOpenDisplay(NULL);
     int whiteColor = WhitePixel(display, DefaultScreen(display));
     window = XCreateSimpleWindow(display, DefaultRootWindow(display), 100, 100, 640, 480, 0, whiteColor, whiteColor);
@@ -151,11 +275,20 @@ int main(int argc, char** argv)
 
     auto deleteMessage = XInternAtom(display, "WM_DELETE_WINDOW", False);
     XSetWMProtocols(display, window, &deleteMessage, 1);
-    
-    CreateBuffer();
 
-    bool isRunning = true;
-    while (isRunning) {
+    if (pipe(wakeupPipe) != 0 || fcntl(wakeupPipe[1], F_SETFL, O_NONBLOCK) != 0) {
+        printf("Cannot create the wakeup pipe.\n");
+        return -1;
+    }
+    GetWindowSize(display, window, &width, &height);
+    presentedFrame = 0;
+    isRunning = true;
+    isConverged = false;
+    std::thread renderThread(RenderFrames, &renderer);
+
+    int connection = ConnectionNumber(display);
+    bool isWindowOpen = true;
+    while (isWindowOpen) {
         while (XPending(display)) {
             XEvent event;
             XNextEvent(display, &event);
@@ -163,21 +296,51 @@ int main(int argc, char** argv)
                 continue;
             }
             if (event.type == ClientMessage && event.xclient.data.l[0] == deleteMessage) {
-                isRunning = false;
+                isWindowOpen = false;
                 break;
             }
             else if (event.type == Expose) {
-                DestroyBuffer();
-                CreateBuffer();
+                uint32_t newWidth, newHeight;
+                GetWindowSize(display, window, &newWidth, &newHeight);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (newWidth != width || newHeight != height) {
+                        width = newWidth;
+                        height = newHeight;
+                        isConverged = false;
+                        cancelFrame = true;
+                    }
+                }
+                condition.notify_one();
+                PresentFrame();
             }
         }
-        if (isRunning) {
-            renderer.Render(buffer, width, height);
-            XPutImage(display, window, DefaultGC(display, 0), image, 0, 0, 0, 0, width, height);
+        if (!isWindowOpen) {
+            break;
+        }
+
+        fd_set descriptors;
+        FD_ZERO(&descriptors);
+        FD_SET(connection, &descriptors);
+        FD_SET(wakeupPipe[0], &descriptors);
+        if (select(std::max(connection, wakeupPipe[0]) + 1, &descriptors, NULL, NULL, NULL) > 0 && FD_ISSET(wakeupPipe[0], &descriptors)) {
+            char messages[64];
+            if (read(wakeupPipe[0], messages, sizeof(messages)) > 0) {
+                PresentFrame();
+            }
         }
     }
 
-    DestroyBuffer();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isRunning = false;
+        cancelFrame = true;
+    }
+    condition.notify_one();
+    renderThread.join();
+    close(wakeupPipe[0]);
+    close(wakeupPipe[1]);
+
     XDestroyWindow(display, window);
     XCloseDisplay(display);
 